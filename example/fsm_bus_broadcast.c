@@ -0,0 +1,127 @@
+/**
+ * @file fsm_bus_broadcast.c
+ * @author Mauro Medina
+ * @brief Two LED fsm (see app_led_fsm.md) sharing one published event through
+ *        the event bus.
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+#include "fsm_bus.h"
+
+#ifndef LOG_CHECK
+#define LOG_CHECK(val) (val == 1 ? "OK" : "ERROR")
+#endif
+
+// Define states
+enum {
+    ROOT_ST = FSM_ST_FIRST,     // 1
+    INIT_ST,                    // 2
+    OFF_ST,                     // 3
+    ON_ST,                      // 4
+    UPDATE_ST                   // 5
+};
+
+// Define events
+enum {
+    EV_READY = FSM_EV_FIRST,    // 0
+    EV_ON,                      // 1
+    EV_OFF,                     // 2
+    EV_TOGGLE,                  // 3
+    EV_UPDATE                   // 4
+};
+
+struct led_pattern {
+    const char *name;
+    int users;                  // Machines that used the payload
+    int released;               // Times the bus released it
+};
+
+static void enter_off(fsm_t *self, void* data) { printf("LED off\n"); }
+static void enter_on(fsm_t *self, void* data) { printf("LED on\n"); }
+
+static void enter_update(fsm_t *self, void* data) {
+    struct led_pattern *pattern = data;
+
+    printf("LED updating to \"%s\"\n", pattern->name);
+    pattern->users++;
+}
+
+static void release_pattern(void *data) {
+    struct led_pattern *pattern = data;
+
+    pattern->released++;
+}
+
+FSM_STATES_INIT(led)
+//           name  state id    parent       sub          entry         run   exit
+FSM_CREATE_STATE(led, ROOT_ST,   FSM_ST_NONE, INIT_ST,     NULL,         NULL, NULL)
+FSM_CREATE_STATE(led, INIT_ST,   ROOT_ST,     FSM_ST_NONE, NULL,         NULL, NULL)
+FSM_CREATE_STATE(led, OFF_ST,    ROOT_ST,     FSM_ST_NONE, enter_off,    NULL, NULL)
+FSM_CREATE_STATE(led, ON_ST,     ROOT_ST,     FSM_ST_NONE, enter_on,     NULL, NULL)
+FSM_CREATE_STATE(led, UPDATE_ST, ROOT_ST,     FSM_ST_NONE, enter_update, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(led)
+FSM_TRANSITION_CREATE(led, INIT_ST,   EV_READY,  OFF_ST)
+FSM_TRANSITION_CREATE(led, OFF_ST,    EV_ON,     ON_ST)
+FSM_TRANSITION_CREATE(led, OFF_ST,    EV_TOGGLE, ON_ST)
+FSM_TRANSITION_CREATE(led, ON_ST,     EV_TOGGLE, OFF_ST)
+FSM_TRANSITION_CREATE(led, ON_ST,     EV_OFF,    OFF_ST)
+FSM_TRANSITION_CREATE(led, ON_ST,     EV_UPDATE, UPDATE_ST)
+FSM_TRANSITION_CREATE(led, UPDATE_ST, EV_READY,  ON_ST)
+FSM_TRANSITIONS_END()
+
+int main() {
+    static struct fsm_bus bus;
+    struct led_pattern pattern = { "blink", 0, 0 };
+    fsm_t led_a, led_b;
+    int ret = 0;
+
+    fsm_init(&led_a, FSM_TRANSITIONS_GET(led), FSM_TRANSITIONS_SIZE(led),
+             &FSM_STATE_GET(led, ROOT_ST), NULL);
+    fsm_init(&led_b, FSM_TRANSITIONS_GET(led), FSM_TRANSITIONS_SIZE(led),
+             &FSM_STATE_GET(led, ROOT_ST), NULL);
+
+    // Both machines run in worker 0
+    fsm_bus_init(&bus);
+    ret |= fsm_bus_subscribe_fsm(&bus, &led_a, 0);
+    ret |= fsm_bus_subscribe_fsm(&bus, &led_b, 0);
+    printf("Subscribing... %s\n", LOG_CHECK((ret == 0)));
+
+    // Drive both machines to ON
+    fsm_bus_publish(&bus, EV_READY, NULL, NULL);
+    fsm_bus_publish(&bus, EV_ON, NULL, NULL);
+    fsm_bus_deliver(&bus, 0);
+    fsm_run(&led_a);
+    fsm_run(&led_b);
+    printf("Broadcast... %s\n", LOG_CHECK((fsm_state_get(&led_a) == ON_ST && fsm_state_get(&led_b) == ON_ST)));
+
+    // One publish, one shared payload
+    printf("Publishing... %s\n", LOG_CHECK((fsm_bus_publish(&bus, EV_UPDATE, &pattern, release_pattern) == 1)));
+    printf("Delivering... %s\n", LOG_CHECK((fsm_bus_deliver(&bus, 0) == 1 && pattern.released == 0)));
+
+    fsm_run(&led_a);
+    printf("First machine done, payload kept... %s\n", LOG_CHECK((pattern.users == 1 && pattern.released == 0)));
+
+    fsm_run(&led_b);
+    printf("Second machine done, payload released once... %s\n", LOG_CHECK((pattern.users == 2 && pattern.released == 1)));
+
+    // Later events don't touch the released payload
+    fsm_bus_publish(&bus, EV_READY, NULL, NULL);
+    fsm_bus_deliver(&bus, 0);
+    fsm_run(&led_a);
+    fsm_run(&led_b);
+    printf("No second release... %s\n", LOG_CHECK((pattern.released == 1 && fsm_state_get(&led_a) == ON_ST)));
+
+    fsm_bus_unsubscribe_fsm(&bus, &led_a);
+    fsm_bus_unsubscribe_fsm(&bus, &led_b);
+
+    return pattern.released == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
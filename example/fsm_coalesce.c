@@ -0,0 +1,126 @@
+/**
+ * @file fsm_coalesce.c
+ * @author Mauro Medina
+ * @brief Volume knob fsm checking the event coalescing policies.
+ *
+ * @details Build with -DFSM_COALESCE_EVENTS=1 for every source file.
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+
+#if !FSM_COALESCE_EVENTS
+#error "Build with -DFSM_COALESCE_EVENTS=1"
+#endif
+
+#ifndef LOG_CHECK
+#define LOG_CHECK(val) (val == 1 ? "OK" : "ERROR")
+#endif
+
+// Define states
+enum {
+    IDLE_ST = FSM_ST_FIRST,     // 1
+    BUSY_ST                     // 2
+};
+
+// Define events
+enum {
+    EV_VOLUME_UP = FSM_EV_FIRST,    // 0, repeats counted
+    EV_VOLUME_SET,                  // 1, latest value wins
+    EV_MUTE,                        // 2, first one wins
+    EV_CLICK                        // 3, never coalesced
+};
+
+static int entries;
+static int last_count;
+static int last_value;
+
+static void enter_state(fsm_t *self, void* data) {
+    entries++;
+    last_count = fsm_event_count(self);
+    last_value = data ? *(int *)data : -1;
+}
+
+FSM_STATES_INIT(knob)
+//           name   state id  parent       sub          entry        run   exit
+FSM_CREATE_STATE(knob, IDLE_ST, FSM_ST_NONE, FSM_ST_NONE, enter_state, NULL, NULL)
+FSM_CREATE_STATE(knob, BUSY_ST, FSM_ST_NONE, FSM_ST_NONE, enter_state, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(knob)
+FSM_TRANSITION_CREATE(knob, IDLE_ST, EV_VOLUME_UP,  BUSY_ST)
+FSM_TRANSITION_CREATE(knob, BUSY_ST, EV_VOLUME_UP,  IDLE_ST)
+FSM_TRANSITION_CREATE(knob, IDLE_ST, EV_VOLUME_SET, BUSY_ST)
+FSM_TRANSITION_CREATE(knob, BUSY_ST, EV_VOLUME_SET, IDLE_ST)
+FSM_TRANSITION_CREATE(knob, IDLE_ST, EV_MUTE,       BUSY_ST)
+FSM_TRANSITION_CREATE(knob, BUSY_ST, EV_MUTE,       IDLE_ST)
+FSM_TRANSITION_CREATE(knob, IDLE_ST, EV_CLICK,      BUSY_ST)
+FSM_TRANSITION_CREATE(knob, BUSY_ST, EV_CLICK,      IDLE_ST)
+FSM_TRANSITIONS_END()
+
+static const uint8_t knob_coalesce[] = {
+    [EV_VOLUME_UP]  = FSM_COALESCE_COUNT,
+    [EV_VOLUME_SET] = FSM_COALESCE_REPLACE,
+    [EV_MUTE]       = FSM_COALESCE_KEEP_FIRST,
+};
+
+int main() {
+    static int values[] = { 10, 20, 30, 40, 50 };
+    fsm_t knob_fsm;
+    int ok = 1;
+
+    fsm_init(&knob_fsm, FSM_TRANSITIONS_GET(knob), FSM_TRANSITIONS_SIZE(knob),
+             &FSM_STATE_GET(knob, IDLE_ST), NULL);
+    fsm_coalesce_set(&knob_fsm, knob_coalesce, sizeof(knob_coalesce));
+
+    // Five clicks of the knob, one transition that sees them all
+    for (int i = 0; i < 5; ++i) {
+        fsm_dispatch(&knob_fsm, EV_VOLUME_UP, &values[i]);
+    }
+    entries = 0;
+    fsm_run(&knob_fsm);
+    ok &= entries == 1 && last_count == 5 && last_value == 10;
+    printf("COUNT: one event, count 5, first data... %s\n", LOG_CHECK((entries == 1 && last_count == 5 && last_value == 10)));
+
+    for (int i = 0; i < 5; ++i) {
+        fsm_dispatch(&knob_fsm, EV_VOLUME_SET, &values[i]);
+    }
+    entries = 0;
+    fsm_run(&knob_fsm);
+    ok &= entries == 1 && last_count == 1 && last_value == 50;
+    printf("REPLACE: one event, last data... %s\n", LOG_CHECK((entries == 1 && last_count == 1 && last_value == 50)));
+
+    for (int i = 0; i < 5; ++i) {
+        fsm_dispatch(&knob_fsm, EV_MUTE, &values[i]);
+    }
+    entries = 0;
+    fsm_run(&knob_fsm);
+    ok &= entries == 1 && last_count == 1 && last_value == 10;
+    printf("KEEP_FIRST: one event, first data... %s\n", LOG_CHECK((entries == 1 && last_count == 1 && last_value == 10)));
+
+    for (int i = 0; i < 5; ++i) {
+        fsm_dispatch(&knob_fsm, EV_CLICK, &values[i]);
+    }
+    entries = 0;
+    fsm_run(&knob_fsm);
+    ok &= entries == 5 && last_count == 1;
+    printf("Not in the table: every event queued... %s\n", LOG_CHECK((entries == 5 && last_count == 1)));
+
+    // A processed event can't be coalesced anymore, the next one is queued again
+    fsm_dispatch(&knob_fsm, EV_VOLUME_UP, &values[0]);
+    fsm_run(&knob_fsm);
+    fsm_dispatch(&knob_fsm, EV_VOLUME_UP, &values[1]);
+    fsm_dispatch(&knob_fsm, EV_VOLUME_UP, &values[2]);
+    entries = 0;
+    fsm_run(&knob_fsm);
+    ok &= entries == 1 && last_count == 2 && last_value == 20;
+    printf("COUNT restarts after processing... %s\n", LOG_CHECK((entries == 1 && last_count == 2 && last_value == 20)));
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
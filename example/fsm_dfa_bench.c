@@ -0,0 +1,142 @@
+/**
+ * @file fsm_dfa_bench.c
+ * @author Mauro Medina
+ * @brief Token classifier fsm fed through the dense table (streaming mode),
+ *        checked against the events queue and timed.
+ *
+ * @details Usage: fsm_dfa_bench [MB]   input size, 16 MB by default
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fsm.h"
+
+#ifndef LOG_CHECK
+#define LOG_CHECK(val) (val == 1 ? "OK" : "ERROR")
+#endif
+
+#define STREAMS 8
+
+// Define states
+enum {
+    ROOT_ST = FSM_ST_FIRST,     // 1
+    BLANK_ST,                   // 2
+    WORD_ST,                    // 3
+    NUMBER_ST,                  // 4
+    LINE_ST                     // 5
+};
+
+static unsigned long lines;
+
+static void enter_line(fsm_t *self, void* data) { lines++; }
+
+FSM_STATES_INIT(lexer)
+//           name    state id   parent       sub          entry       run   exit
+FSM_CREATE_STATE(lexer, ROOT_ST,   FSM_ST_NONE, BLANK_ST,    NULL,       NULL, NULL)
+FSM_CREATE_STATE(lexer, BLANK_ST,  ROOT_ST,     FSM_ST_NONE, NULL,       NULL, NULL)
+FSM_CREATE_STATE(lexer, WORD_ST,   ROOT_ST,     FSM_ST_NONE, NULL,       NULL, NULL)
+FSM_CREATE_STATE(lexer, NUMBER_ST, ROOT_ST,     FSM_ST_NONE, NULL,       NULL, NULL)
+FSM_CREATE_STATE(lexer, LINE_ST,   ROOT_ST,     FSM_ST_NONE, enter_line, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(lexer)
+FSM_TRANSITION_CREATE(lexer, ROOT_ST,   ' ',  BLANK_ST)
+FSM_TRANSITION_CREATE(lexer, ROOT_ST,   '\n', LINE_ST)
+FSM_TRANSITION_CREATE(lexer, BLANK_ST,  'a',  WORD_ST)
+FSM_TRANSITION_CREATE(lexer, BLANK_ST,  '1',  NUMBER_ST)
+FSM_TRANSITION_CREATE(lexer, LINE_ST,   'a',  WORD_ST)
+FSM_TRANSITION_CREATE(lexer, LINE_ST,   '1',  NUMBER_ST)
+FSM_TRANSITION_CREATE(lexer, NUMBER_ST, 'a',  WORD_ST)
+FSM_TRANSITIONS_END()
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Random "a1 " text, with a newline every line_len bytes on average (0: none)
+static void fill(uint8_t *buf, size_t n, unsigned line_len) {
+    static const char alphabet[] = "a1 ";
+
+    for (size_t i = 0; i < n; ++i) {
+        buf[i] = (line_len && rand() % line_len == 0) ? '\n' : (uint8_t)alphabet[rand() % 3];
+    }
+}
+
+static double bench_feed(fsm_t *fsm, const uint8_t *buf, size_t n) {
+    double t = now();
+
+    if ((size_t)fsm_feed(fsm, buf, n) != n) {
+        return 0;
+    }
+    return (double)n / (now() - t) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    static fsm_dfa_t dfa;
+    size_t n = (size_t)(argc > 1 ? atoi(argv[1]) : 16) << 20;
+    const uint8_t *streams[STREAMS];
+    uint8_t states[STREAMS];
+    unsigned long fed_lines;
+    fsm_t feed_fsm, queue_fsm;
+    uint8_t *buf;
+    double t;
+    int ok;
+
+    buf = malloc(n);
+    if (buf == NULL || n < STREAMS) {
+        return EXIT_FAILURE;
+    }
+    srand(1);
+
+    fsm_init(&feed_fsm, FSM_TRANSITIONS_GET(lexer), FSM_TRANSITIONS_SIZE(lexer),
+             &FSM_STATE_GET(lexer, ROOT_ST), NULL);
+    fsm_init(&queue_fsm, FSM_TRANSITIONS_GET(lexer), FSM_TRANSITIONS_SIZE(lexer),
+             &FSM_STATE_GET(lexer, ROOT_ST), NULL);
+
+    printf("Not compiled... %s\n", LOG_CHECK((fsm_feed(&feed_fsm, buf, 1) < 0)));
+    printf("Compiling... %s\n", LOG_CHECK((fsm_dfa_compile(&feed_fsm, &dfa) == 0)));
+
+    // Same states and actions as one fsm_dispatch + fsm_run per symbol
+    fill(buf, 1 << 16, 64);
+    lines = 0;
+    for (size_t i = 0; i < 1 << 16; ++i) {
+        fsm_dispatch(&queue_fsm, buf[i], NULL);
+        fsm_run(&queue_fsm);
+    }
+    fed_lines = lines;
+    lines = 0;
+    ok = fsm_feed(&feed_fsm, buf, 1 << 16) == 1 << 16;
+    printf("Same result as the queue... %s\n",
+           LOG_CHECK((ok && lines == fed_lines && fsm_state_get(&feed_fsm) == fsm_state_get(&queue_fsm))));
+
+    fill(buf, n, 0);
+    printf("fsm_feed, no actions:              %6.2f GB/s\n", bench_feed(&feed_fsm, buf, n));
+
+    fill(buf, n, 4096);
+    printf("fsm_feed, one action / 4 KB:       %6.2f GB/s\n", bench_feed(&feed_fsm, buf, n));
+
+    fill(buf, n, 64);
+    printf("fsm_feed, one action / 64 B:       %6.2f GB/s\n", bench_feed(&feed_fsm, buf, n));
+
+    fill(buf, n, 0);
+    for (size_t k = 0; k < STREAMS; ++k) {
+        streams[k] = buf + k * (n / STREAMS);
+        states[k] = (uint8_t)fsm_dfa_index(&dfa, BLANK_ST);
+    }
+    t = now();
+    fsm_dfa_feed_streams(&dfa, streams, n / STREAMS, states, STREAMS);
+    printf("fsm_dfa_feed_streams, %d streams:   %6.2f GB/s\n", STREAMS, (double)n / (now() - t) / 1e9);
+
+    free(buf);
+
+    return EXIT_SUCCESS;
+}
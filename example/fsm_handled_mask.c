@@ -0,0 +1,141 @@
+/**
+ * @file fsm_handled_mask.c
+ * @author Mauro Medina
+ * @brief Player fsm checking the handled events mask: ancestor transitions,
+ *        early drop, rejected events and the table scan fallback.
+ *
+ * @details Build with -DFSM_HANDLED_MASK=1 for every source file.
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm.h"
+
+#if !FSM_HANDLED_MASK
+#error "Build with -DFSM_HANDLED_MASK=1"
+#endif
+
+#ifndef LOG_CHECK
+#define LOG_CHECK(val) (val == 1 ? "OK" : "ERROR")
+#endif
+
+// Define states
+enum {
+    ROOT_ST = FSM_ST_FIRST,     // 1
+    STOPPED_ST,                 // 2
+    ACTIVE_ST,                  // 3
+    PLAYING_ST,                 // 4
+    OFF_ST,                     // 5
+    // Out of the mask range (FSM_MAX_STATES), uses the table scan
+    SLEEP_ST = 40
+};
+
+// Define events
+enum {
+    EV_PLAY = FSM_EV_FIRST,     // 0
+    EV_STOP,                    // 1
+    EV_POWER,                   // 2
+    EV_NEXT                     // 3
+};
+
+FSM_STATES_INIT(player)
+//           name     state id    parent       sub          entry run   exit
+FSM_CREATE_STATE(player, ROOT_ST,    FSM_ST_NONE, STOPPED_ST,  NULL, NULL, NULL)
+FSM_CREATE_STATE(player, STOPPED_ST, ROOT_ST,     FSM_ST_NONE, NULL, NULL, NULL)
+FSM_CREATE_STATE(player, ACTIVE_ST,  ROOT_ST,     PLAYING_ST,  NULL, NULL, NULL)
+FSM_CREATE_STATE(player, PLAYING_ST, ACTIVE_ST,   FSM_ST_NONE, NULL, NULL, NULL)
+FSM_CREATE_STATE(player, OFF_ST,     FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(player)
+FSM_TRANSITION_CREATE(player, STOPPED_ST, EV_PLAY,  ACTIVE_ST)
+FSM_TRANSITION_CREATE(player, ACTIVE_ST,  EV_STOP,  STOPPED_ST)
+FSM_TRANSITION_CREATE(player, PLAYING_ST, EV_NEXT,  PLAYING_ST)
+FSM_TRANSITION_CREATE(player, ROOT_ST,    EV_POWER, OFF_ST)
+FSM_TRANSITIONS_END()
+
+FSM_STATES_INIT(remote)
+//           name     state id    parent       sub          entry run   exit
+FSM_CREATE_STATE(remote, ROOT_ST,    FSM_ST_NONE, STOPPED_ST,  NULL, NULL, NULL)
+FSM_CREATE_STATE(remote, STOPPED_ST, ROOT_ST,     FSM_ST_NONE, NULL, NULL, NULL)
+FSM_CREATE_STATE(remote, SLEEP_ST,   ROOT_ST,     FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(remote)
+FSM_TRANSITION_CREATE(remote, STOPPED_ST, EV_POWER, SLEEP_ST)
+FSM_TRANSITION_CREATE(remote, SLEEP_ST,   EV_POWER, STOPPED_ST)
+FSM_TRANSITIONS_END()
+
+int main() {
+    fsm_t player_fsm, remote_fsm;
+    int ok = 1, check;
+
+    fsm_init(&player_fsm, FSM_TRANSITIONS_GET(player), FSM_TRANSITIONS_SIZE(player),
+             &FSM_STATE_GET(player, ROOT_ST), NULL);
+
+    // Handled by the state itself
+    fsm_dispatch(&player_fsm, EV_PLAY, NULL);
+    fsm_run(&player_fsm);
+    check = fsm_state_get(&player_fsm) == PLAYING_ST && fsm_rejected_events_get(&player_fsm) == 0;
+    ok &= check;
+    printf("Own transition... %s\n", LOG_CHECK(check));
+
+    // Handled by the parent (ACTIVE_ST) only
+    fsm_dispatch(&player_fsm, EV_STOP, NULL);
+    fsm_run(&player_fsm);
+    check = fsm_state_get(&player_fsm) == STOPPED_ST && fsm_rejected_events_get(&player_fsm) == 0;
+    ok &= check;
+    printf("Ancestor transition... %s\n", LOG_CHECK(check));
+
+    // No transition in STOPPED_ST or ROOT_ST, discarded when dequeued
+    fsm_dispatch(&player_fsm, EV_NEXT, NULL);
+    fsm_dispatch(&player_fsm, EV_STOP, NULL);
+    check = fsm_has_pending_events(&player_fsm) != 0;
+    fsm_run(&player_fsm);
+    check = check && fsm_state_get(&player_fsm) == STOPPED_ST && fsm_rejected_events_get(&player_fsm) == 2;
+    ok &= check;
+    printf("Unhandled events rejected... %s\n", LOG_CHECK(check));
+
+    // Early drop: unhandled events never reach the queue
+    fsm_early_drop_set(&player_fsm, 1);
+    fsm_dispatch(&player_fsm, EV_NEXT, NULL);
+    fsm_dispatch(&player_fsm, EV_STOP, NULL);
+    check = !fsm_has_pending_events(&player_fsm) && fsm_rejected_events_get(&player_fsm) == 4;
+    ok &= check;
+    printf("Early drop... %s\n", LOG_CHECK(check));
+
+    // The root state transition is still queued
+    fsm_dispatch(&player_fsm, EV_POWER, NULL);
+    check = fsm_has_pending_events(&player_fsm) != 0;
+    fsm_run(&player_fsm);
+    check = check && fsm_state_get(&player_fsm) == OFF_ST && fsm_rejected_events_get(&player_fsm) == 4;
+    ok &= check;
+    printf("Early drop keeps ancestor events... %s\n", LOG_CHECK(check));
+
+    // A state id out of the mask range disables the mask for the whole machine
+    fsm_init(&remote_fsm, FSM_TRANSITIONS_GET(remote), FSM_TRANSITIONS_SIZE(remote),
+             &FSM_STATE_GET(remote, ROOT_ST), NULL);
+    fsm_early_drop_set(&remote_fsm, 1);
+
+    fsm_dispatch(&remote_fsm, EV_PLAY, NULL);
+    check = fsm_has_pending_events(&remote_fsm) != 0;
+    fsm_run(&remote_fsm);
+    check = check && fsm_state_get(&remote_fsm) == STOPPED_ST && fsm_rejected_events_get(&remote_fsm) == 1;
+    ok &= check;
+    printf("Fallback: not dropped, rejected by the scan... %s\n", LOG_CHECK(check));
+
+    fsm_dispatch(&remote_fsm, EV_POWER, NULL);
+    fsm_run(&remote_fsm);
+    fsm_dispatch(&remote_fsm, EV_PLAY, NULL);
+    fsm_run(&remote_fsm);
+    check = fsm_state_get(&remote_fsm) == SLEEP_ST && fsm_rejected_events_get(&remote_fsm) == 2;
+    ok &= check;
+    printf("Fallback: out of range state... %s\n", LOG_CHECK(check));
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file fsm_led_image.c
+ * @author Mauro Medina
+ * @brief LED fsm (see app_led_fsm.md) compiled to an image and loaded back.
+ *
+ * @details Usage:
+ *              fsm_led_image build led.fsmi    compiles the tables below to an image
+ *              fsm_led_image run led.fsmi      maps the image and runs it
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_image.h"
+
+#ifndef LOG_CHECK
+#define LOG_CHECK(val) (val == 1 ? "OK" : "ERROR")
+#endif
+
+// Define states
+enum {
+    ROOT_ST = FSM_ST_FIRST,     // 1
+    INIT_ST,                    // 2
+    OFF_ST,                     // 3
+    ON_ST,                      // 4
+    UPDATE_ST                   // 5
+};
+
+// Define events
+enum {
+    EV_READY = FSM_EV_FIRST,    // 0
+    EV_ON,                      // 1
+    EV_OFF,                     // 2
+    EV_TOGGLE,                  // 3
+    EV_UPDATE                   // 4
+};
+
+static void enter_off(fsm_t *self, void* data) { printf("LED off\n"); }
+static void enter_on(fsm_t *self, void* data) { printf("LED on\n"); }
+static void enter_update(fsm_t *self, void* data) { printf("LED updating\n"); }
+
+// Symbol registration table, the ids must be the same when building and loading
+static const fsm_image_action_t led_symbols[] = {
+    [FSM_IMAGE_SYM_NONE] = NULL,
+    enter_off,
+    enter_on,
+    enter_update,
+};
+
+FSM_STATES_INIT(led)
+//           name  state id    parent       sub          entry         run   exit
+FSM_CREATE_STATE(led, ROOT_ST,   FSM_ST_NONE, INIT_ST,     NULL,         NULL, NULL)
+FSM_CREATE_STATE(led, INIT_ST,   ROOT_ST,     FSM_ST_NONE, NULL,         NULL, NULL)
+FSM_CREATE_STATE(led, OFF_ST,    ROOT_ST,     FSM_ST_NONE, enter_off,    NULL, NULL)
+FSM_CREATE_STATE(led, ON_ST,     ROOT_ST,     FSM_ST_NONE, enter_on,     NULL, NULL)
+FSM_CREATE_STATE(led, UPDATE_ST, ROOT_ST,     FSM_ST_NONE, enter_update, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(led)
+FSM_TRANSITION_CREATE(led, INIT_ST,   EV_READY,  OFF_ST)
+FSM_TRANSITION_CREATE(led, OFF_ST,    EV_ON,     ON_ST)
+FSM_TRANSITION_CREATE(led, OFF_ST,    EV_TOGGLE, ON_ST)
+FSM_TRANSITION_CREATE(led, ON_ST,     EV_TOGGLE, OFF_ST)
+FSM_TRANSITION_CREATE(led, ON_ST,     EV_OFF,    OFF_ST)
+FSM_TRANSITION_CREATE(led, ON_ST,     EV_UPDATE, UPDATE_ST)
+FSM_TRANSITION_CREATE(led, UPDATE_ST, EV_READY,  ON_ST)
+FSM_TRANSITIONS_END()
+
+static int build(const char *path) {
+    int size = fsm_image_build(NULL, 0, FSM_STATES_GET(led), FSM_STATES_SIZE(led),
+                               FSM_TRANSITIONS_GET(led), FSM_TRANSITIONS_SIZE(led),
+                               led_symbols, sizeof(led_symbols) / sizeof(led_symbols[0]));
+    uint32_t *image;
+    int ret;
+
+    if (size < 0) {
+        return -1;
+    }
+
+    image = malloc((size_t)size);
+    if (image == NULL) {
+        return -1;
+    }
+
+    ret = fsm_image_build(image, (size_t)size, FSM_STATES_GET(led), FSM_STATES_SIZE(led),
+                          FSM_TRANSITIONS_GET(led), FSM_TRANSITIONS_SIZE(led),
+                          led_symbols, sizeof(led_symbols) / sizeof(led_symbols[0]));
+    if (ret > 0) {
+        ret = fsm_image_save(path, image, (size_t)size);
+    }
+    free(image);
+
+    printf("Image %s built (%d bytes)... %s\n", path, size, LOG_CHECK((ret == 0)));
+
+    return ret;
+}
+
+static int run(const char *path) {
+    static fsm_state_t states[16];
+    static fsm_transition_t transitions[32];
+    struct fsm_image img;
+    fsm_t led_fsm;
+    int ret = 0;
+
+    if (fsm_image_map(&img, path) != 0) {
+        printf("Mapping %s... ERROR\n", path);
+        return -1;
+    }
+
+    ret = fsm_image_init(&led_fsm, &img, led_symbols, sizeof(led_symbols) / sizeof(led_symbols[0]),
+                         states, 16, transitions, 32, ROOT_ST, NULL);
+    printf("Loading image... %s\n", LOG_CHECK((ret == 0 && fsm_state_get(&led_fsm) == INIT_ST)));
+
+    fsm_dispatch(&led_fsm, EV_READY, NULL);
+    ret |= fsm_run(&led_fsm);
+    printf("Ready... %s\n", LOG_CHECK((fsm_state_get(&led_fsm) == OFF_ST)));
+
+    fsm_dispatch(&led_fsm, EV_TOGGLE, NULL);
+    ret |= fsm_run(&led_fsm);
+    printf("Toggle... %s\n", LOG_CHECK((fsm_state_get(&led_fsm) == ON_ST)));
+
+    fsm_dispatch(&led_fsm, EV_UPDATE, NULL);
+    fsm_dispatch(&led_fsm, EV_READY, NULL);
+    ret |= fsm_run(&led_fsm);
+    printf("Update... %s\n", LOG_CHECK((fsm_state_get(&led_fsm) == ON_ST)));
+
+    fsm_image_unmap(&img);
+
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "build") == 0) {
+        return build(argv[2]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc == 3 && strcmp(argv[1], "run") == 0) {
+        return run(argv[2]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    printf("usage: %s build|run <image>\n", argv[0]);
+    return EXIT_FAILURE;
+}
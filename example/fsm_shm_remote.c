@@ -0,0 +1,124 @@
+/**
+ * @file fsm_shm_remote.c
+ * @author Mauro Medina
+ * @brief LED fsm (see app_led_fsm.md) driven by a producer running in another
+ *        process through the shared memory events queue.
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fsm.h"
+#include "fsm_shm.h"
+
+#ifndef LOG_CHECK
+#define LOG_CHECK(val) (val == 1 ? "OK" : "ERROR")
+#endif
+
+#define SHM_NAME "/fsm_led_remote"
+
+// Define states
+enum {
+    ROOT_ST = FSM_ST_FIRST,     // 1
+    INIT_ST,                    // 2
+    OFF_ST,                     // 3
+    ON_ST,                      // 4
+    UPDATE_ST                   // 5
+};
+
+// Define events
+enum {
+    EV_READY = FSM_EV_FIRST,    // 0
+    EV_ON,                      // 1
+    EV_OFF,                     // 2
+    EV_TOGGLE,                  // 3
+    EV_UPDATE                   // 4
+};
+
+static void enter_off(fsm_t *self, void* data) { printf("LED off\n"); }
+static void enter_on(fsm_t *self, void* data) { printf("LED on\n"); }
+static void enter_update(fsm_t *self, void* data) { printf("LED updating to \"%s\"\n", (const char *)data); }
+
+FSM_STATES_INIT(led)
+//           name  state id    parent       sub          entry         run   exit
+FSM_CREATE_STATE(led, ROOT_ST,   FSM_ST_NONE, INIT_ST,     NULL,         NULL, NULL)
+FSM_CREATE_STATE(led, INIT_ST,   ROOT_ST,     FSM_ST_NONE, NULL,         NULL, NULL)
+FSM_CREATE_STATE(led, OFF_ST,    ROOT_ST,     FSM_ST_NONE, enter_off,    NULL, NULL)
+FSM_CREATE_STATE(led, ON_ST,     ROOT_ST,     FSM_ST_NONE, enter_on,     NULL, NULL)
+FSM_CREATE_STATE(led, UPDATE_ST, ROOT_ST,     FSM_ST_NONE, enter_update, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(led)
+FSM_TRANSITION_CREATE(led, INIT_ST,   EV_READY,  OFF_ST)
+FSM_TRANSITION_CREATE(led, OFF_ST,    EV_ON,     ON_ST)
+FSM_TRANSITION_CREATE(led, OFF_ST,    EV_TOGGLE, ON_ST)
+FSM_TRANSITION_CREATE(led, ON_ST,     EV_TOGGLE, OFF_ST)
+FSM_TRANSITION_CREATE(led, ON_ST,     EV_OFF,    OFF_ST)
+FSM_TRANSITION_CREATE(led, ON_ST,     EV_UPDATE, UPDATE_ST)
+FSM_TRANSITION_CREATE(led, UPDATE_ST, EV_READY,  ON_ST)
+FSM_TRANSITIONS_END()
+
+// Producer process: only knows the segment name and the events
+static int producer(void) {
+    static const char pattern[] = "blink";
+    struct fsm_shm shm;
+    int ret = 0;
+
+    if (fsm_shm_open(&shm, SHM_NAME) != 0) {
+        return -1;
+    }
+
+    ret |= fsm_remote_dispatch(&shm, EV_READY, NULL, 0);
+    ret |= fsm_remote_dispatch(&shm, EV_ON, NULL, 0);
+    ret |= fsm_remote_dispatch(&shm, EV_UPDATE, pattern, sizeof(pattern));
+    ret |= fsm_remote_dispatch(&shm, EV_READY, NULL, 0);
+    ret |= fsm_remote_dispatch(&shm, EV_OFF, NULL, 0);
+
+    fsm_shm_close(&shm);
+
+    return ret;
+}
+
+int main() {
+    static struct fsm_shm shm;
+    fsm_t led_fsm;
+    int status, events = 0;
+    pid_t pid;
+
+    // A previous run may have been killed before unlinking its segment
+    fsm_shm_unlink(SHM_NAME);
+
+    if (fsm_shm_create(&shm, SHM_NAME) != 0) {
+        printf("Creating " SHM_NAME "... ERROR\n");
+        return EXIT_FAILURE;
+    }
+
+    fsm_init(&led_fsm, FSM_TRANSITIONS_GET(led), FSM_TRANSITIONS_SIZE(led),
+             &FSM_STATE_GET(led, ROOT_ST), NULL);
+
+    pid = fork();
+    if (pid == 0) {
+        _exit(producer() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Host loop: sleep until remote events arrive, then run them
+    while (events < 5 && fsm_shm_wait(&shm, 1000)) {
+        events += fsm_shm_poll(&shm, &led_fsm);
+        fsm_run(&led_fsm);
+    }
+
+    waitpid(pid, &status, 0);
+    printf("Remote events received... %s\n", LOG_CHECK((events == 5 && WIFEXITED(status) && WEXITSTATUS(status) == 0)));
+    printf("Final state... %s\n", LOG_CHECK((fsm_state_get(&led_fsm) == OFF_ST)));
+
+    fsm_shm_close(&shm);
+    fsm_shm_unlink(SHM_NAME);
+
+    return fsm_state_get(&led_fsm) == OFF_ST ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -10,6 +10,7 @@
  */
 #include <stddef.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "fsm.h"
 
@@ -18,8 +19,25 @@ struct internal_ctx {
 	int terminate:  1;
 	int is_exit:    1;
     int handled:    1;
+    int early_drop: 1;
+    int mask_ok:    1;
 };
 
+#define MASK_WORD(ev)   ((ev) / 32)
+#define MASK_BIT(ev)    (1u << ((ev) % 32))
+
+#if FSM_DFA_MAX_STATES > 255
+#error "FSM_DFA_MAX_STATES must fit a uint8_t state index"
+#endif
+
+/* Row offset of the dense tables */
+#define DFA_ROW(index)      ((size_t)(index) * FSM_DFA_SYMBOLS)
+#define DFA_INDEX(offset)   ((offset) / FSM_DFA_SYMBOLS)
+/* fsm_feed sentinel row, reached by the transitions running actions */
+#define DFA_SENTINEL        DFA_ROW(FSM_DFA_MAX_STATES)
+/* Symbols looked up between two sentinel checks */
+#define DFA_CHUNK           16
+
 
 static void enter_state(fsm_t *fsm, const fsm_state_t *lca, const fsm_state_t *target, void *data) {
     fsm_state_t* state_path[MAX_HIERARCHY_DEPTH];
@@ -68,58 +86,338 @@ static fsm_state_t* find_lca(fsm_state_t *s1, fsm_state_t *s2) {
     return a;
 }
 
+#if FSM_HANDLED_MASK
+static int state_in_mask(const fsm_state_t *state) {
+    return state->state_id >= 0 && state->state_id < FSM_MAX_STATES;
+}
+
+/* ORs the events handled by every ancestor into the state mask */
+static int mask_resolve(fsm_t *fsm, const fsm_state_t *state) {
+    uint32_t *mask;
+
+    for (const fsm_state_t *s = state; s != NULL; s = s->parent) {
+        if (!state_in_mask(s)) {
+            return -1;
+        }
+    }
+
+    mask = fsm->handled_mask[state->state_id];
+    for (const fsm_state_t *s = state->parent; s != NULL; s = s->parent) {
+        for (size_t w = 0; w < FSM_MASK_WORDS; ++w) {
+            mask[w] |= fsm->handled_mask[s->state_id][w];
+        }
+    }
+    return 0;
+}
+
+/* Resolves the states entered through the default substates of a target */
+static int mask_resolve_tree(fsm_t *fsm, const fsm_state_t *state) {
+    for (const fsm_state_t *s = state; s != NULL; s = s->default_substate) {
+        if (mask_resolve(fsm, s) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void mask_build(fsm_t *fsm, const fsm_state_t *initial_state) {
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    memset(fsm->handled_mask, 0, sizeof(fsm->handled_mask));
+    internal->mask_ok = false;
+
+    // Events handled by each state itself
+    for (size_t i = 0; i < fsm->num_transitions; ++i) {
+        const fsm_transition_t *t = &fsm->transitions[i];
+
+        if (t->source_state == NULL) {
+            continue;
+        }
+        /* States out of the mask range can't be tracked, fall back to the scan */
+        if (!state_in_mask(t->source_state)) {
+            return;
+        }
+        if (t->event >= 0 && t->event < FSM_MAX_EVENT_ID) {
+            fsm->handled_mask[t->source_state->state_id][MASK_WORD(t->event)] |= MASK_BIT(t->event);
+        }
+    }
+
+    // Add the ancestors events to every state that can become the current one
+    if (mask_resolve_tree(fsm, initial_state) != 0) {
+        return;
+    }
+    for (size_t i = 0; i < fsm->num_transitions; ++i) {
+        if (fsm->transitions[i].source_state != NULL && mask_resolve_tree(fsm, fsm->transitions[i].target_state) != 0) {
+            return;
+        }
+    }
+
+    internal->mask_ok = true;
+}
+
+static int event_is_handled(fsm_t *fsm, int event) {
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    if (!internal->mask_ok || event < 0 || event >= FSM_MAX_EVENT_ID) {
+        return 1;
+    }
+    return (fsm->handled_mask[fsm->current_state->state_id][MASK_WORD(event)] & MASK_BIT(event)) != 0;
+}
+#else
+/* Without the mask every event goes through the transitions scan */
+static int event_is_handled(fsm_t *fsm, int event) {
+    (void)fsm;
+    (void)event;
+    return 1;
+}
+#endif
+
 void fsm_init(fsm_t *fsm, const fsm_transition_t *transitions, size_t num_transitions, const fsm_state_t* initial_state, void *initial_data) {
     struct internal_ctx *const internal = (void *)&fsm->internal;
 
     fsm->transitions         = transitions;
     fsm->num_transitions     = num_transitions;
+    fsm->index               = NULL;
+    fsm->num_index           = 0;
     fsm->terminate_val       = 0;   
     internal->terminate      = false;
     internal->is_exit        = false;
     fsm->current_data        = initial_data;
+    fsm->rejected_events     = 0;
+    fsm->dfa                 = NULL;
+#if FSM_COALESCE_EVENTS
+    fsm->current_count       = 0;
+    fsm->coalesce            = NULL;
+    fsm->num_coalesce        = 0;
+
+    memset(fsm->pending, 0, sizeof(fsm->pending));
+#endif
 
     ringbuff_init(&fsm->event_queue, &fsm->events_buff, FSM_MAX_EVENTS, sizeof(struct fsm_events_t));
 
+#if FSM_HANDLED_MASK
+    internal->early_drop     = false;
+    mask_build(fsm, initial_state);
+#endif
+
     enter_state(fsm, initial_state, initial_state, initial_data);
 }
 
+void fsm_index_set(fsm_t *fsm, const fsm_range_t *index, size_t num_index) {
+    fsm->index     = index;
+    fsm->num_index = index ? num_index : 0;
+}
+
+void fsm_ref_get(fsm_ref_t *ref) {
+    __atomic_add_fetch(&ref->count, 1, __ATOMIC_RELAXED);
+}
+
+void fsm_ref_put(fsm_ref_t *ref) {
+    if (__atomic_sub_fetch(&ref->count, 1, __ATOMIC_ACQ_REL) == 0 && ref->release) {
+        ref->release(ref);
+    }
+}
+
+static void event_release(struct fsm_events_t *event) {
+    if (event->ref) {
+        fsm_ref_put(event->ref);
+    }
+}
+
+#if FSM_COALESCE_EVENTS
+static int queue_get(fsm_t *fsm, struct fsm_events_t *event) {
+    uint16_t slot = (uint16_t)((fsm->event_queue.p_read - fsm->event_queue.buf) / sizeof(struct fsm_events_t));
+
+    if (ringbuff_get(&fsm->event_queue, event) != 0) {
+        return -1;
+    }
+
+    /* The event leaves the queue, it can't be coalesced anymore */
+    if (event->event >= 0 && event->event < FSM_MAX_EVENT_ID && fsm->pending[event->event] == slot + 1) {
+        fsm->pending[event->event] = 0;
+    }
+    return 0;
+}
+
+static int coalesce_policy(fsm_t *fsm, int event) {
+    if (fsm->coalesce == NULL || event < 0 || (size_t)event >= fsm->num_coalesce || event >= FSM_MAX_EVENT_ID) {
+        return FSM_COALESCE_NONE;
+    }
+    return fsm->coalesce[event];
+}
+
+/* Returns 1 if the event was merged into a pending one */
+static int queue_coalesce(fsm_t *fsm, struct fsm_events_t *event, int policy) {
+    struct fsm_events_t *pending;
+
+    if (policy == FSM_COALESCE_NONE || fsm->pending[event->event] == 0) {
+        return 0;
+    }
+
+    pending = &fsm->events_buff[fsm->pending[event->event] - 1];
+
+    switch (policy) {
+    case FSM_COALESCE_REPLACE:
+        if (event->ref) {
+            fsm_ref_get(event->ref);
+        }
+        event_release(pending);
+        pending->data = event->data;
+        pending->ref  = event->ref;
+        break;
+    case FSM_COALESCE_COUNT:
+        if (pending->count < UINT16_MAX) {
+            pending->count++;
+        }
+        break;
+    default:
+        break;
+    }
+    return 1;
+}
+#else
+static int queue_get(fsm_t *fsm, struct fsm_events_t *event) {
+    return ringbuff_get(&fsm->event_queue, event) != 0 ? -1 : 0;
+}
+#endif
+
+static void queue_put(fsm_t *fsm, struct fsm_events_t *event) {
+    struct fsm_events_t dropped;
+#if FSM_COALESCE_EVENTS
+    int policy = coalesce_policy(fsm, event->event);
+    uint16_t slot;
+#endif
+
+#if FSM_HANDLED_MASK
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    if (internal->early_drop && !event_is_handled(fsm, event->event)) {
+        fsm->rejected_events++;
+        return;
+    }
+#endif
+
+#if FSM_COALESCE_EVENTS
+    if (queue_coalesce(fsm, event, policy)) {
+        return;
+    }
+#endif
+
+    /* The ring overwrites the oldest event when full, release it first */
+    if (ringbuff_num(&fsm->event_queue) >= FSM_MAX_EVENTS - 1 && queue_get(fsm, &dropped) == 0) {
+        event_release(&dropped);
+    }
+
+    if (event->ref) {
+        fsm_ref_get(event->ref);
+    }
+
+#if FSM_COALESCE_EVENTS
+    event->count = 1;
+    slot = (uint16_t)((fsm->event_queue.p_write - fsm->event_queue.buf) / sizeof(struct fsm_events_t));
+    ringbuff_put(&fsm->event_queue, event);
+
+    if (policy != FSM_COALESCE_NONE) {
+        fsm->pending[event->event] = slot + 1;
+    }
+#else
+    ringbuff_put(&fsm->event_queue, event);
+#endif
+}
+
 void fsm_dispatch(fsm_t *fsm, int event, void *data) {
     
-    struct fsm_events_t new_event = {event, data};
+    struct fsm_events_t new_event = { .event = event, .data = data, .ref = NULL };
     
-    ringbuff_put(&fsm->event_queue, &new_event);  
+    queue_put(fsm, &new_event);
 }
 
-static int fsm_process_events(fsm_t *fsm) {
+void fsm_dispatch_ref(fsm_t *fsm, int event, void *data, fsm_ref_t *ref) {
+
+    struct fsm_events_t new_event = { .event = event, .data = data, .ref = ref };
+
+    queue_put(fsm, &new_event);
+}
 
+#if FSM_COALESCE_EVENTS
+void fsm_coalesce_set(fsm_t *fsm, const uint8_t *policies, size_t num_policies) {
+    fsm->coalesce     = policies;
+    fsm->num_coalesce = num_policies;
+}
+
+int fsm_event_count(fsm_t *fsm) {
+    return fsm->current_count;
+}
+#endif
+
+#if FSM_HANDLED_MASK
+void fsm_early_drop_set(fsm_t *fsm, int enable) {
     struct internal_ctx *const internal = (void *)&fsm->internal;
 
-    struct fsm_events_t current_event;
+    internal->early_drop = enable ? true : false;
+}
+#endif
 
-    // TODO: Ver si proceso todos los eventos o de a uno (actualmente procesa todos)
-    while (ringbuff_get(&fsm->event_queue, &current_event) == 0) {
+uint32_t fsm_rejected_events_get(fsm_t *fsm) {
+    return fsm->rejected_events;
+}
+
+/* Takes the transitions of the first hierarchy level handling the event */
+static int handle_event(fsm_t *fsm, int event, void *data) {
+
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    internal->handled = 0;
 
-        internal->handled = 0;
+    fsm_state_t* current = fsm->current_state;
+    while (internal->handled == 0 && current != NULL) 
+    {
+        size_t first = 0, last = fsm->num_transitions;
 
-        fsm_state_t* current = fsm->current_state;
-        while (internal->handled == 0 && current != NULL) 
-        {
-            for (size_t i = 0; i < fsm->num_transitions; ++i) {
-                if (fsm->transitions[i].source_state == current && fsm->transitions[i].event == current_event.event) {
-                    fsm_state_t* lca = find_lca(fsm->current_state, fsm->transitions[i].target_state);
+        if (fsm->index && current->state_id >= 0 && (size_t)current->state_id < fsm->num_index) {
+            first = fsm->index[current->state_id].first;
+            last  = first + fsm->index[current->state_id].num;
+        }
+
+        for (size_t i = first; i < last; ++i) {
+            if (fsm->transitions[i].source_state == current && fsm->transitions[i].event == event) {
+                fsm_state_t* lca = find_lca(fsm->current_state, fsm->transitions[i].target_state);
 
-                    exit_state(fsm, lca, current_event.data);
-                    enter_state(fsm, lca, fsm->transitions[i].target_state, current_event.data);
+                exit_state(fsm, lca, data);
+                enter_state(fsm, lca, fsm->transitions[i].target_state, data);
 
-                    /* No need to continue if terminate was set in the exit action */
-                    if (internal->terminate) {
-                        return fsm->terminate_val;
-                    }
-                    internal->handled = 1;
+                /* No need to continue if terminate was set in the exit action */
+                if (internal->terminate) {
+                    return 1;
                 }
+                internal->handled = 1;
             }
-            current = current->parent;
         }
+        current = current->parent;
+    }
+
+    return internal->handled != 0;
+}
+
+static int fsm_process_events(fsm_t *fsm) {
+
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    struct fsm_events_t current_event;
+
+    // TODO: Ver si proceso todos los eventos o de a uno (actualmente procesa todos)
+    while (queue_get(fsm, &current_event) == 0) {
+
+#if FSM_COALESCE_EVENTS
+        fsm->current_count = current_event.count;
+#endif
+
+        /* No transition from the current state or its ancestors */
+        if (!event_is_handled(fsm, current_event.event) || !handle_event(fsm, current_event.event, current_event.data)) {
+            fsm->rejected_events++;
+        }
+
+        event_release(&current_event);
         
         if (internal->terminate) {
             return fsm->terminate_val;
@@ -128,6 +426,198 @@ static int fsm_process_events(fsm_t *fsm) {
     return 0;
 }
 
+static int dfa_row(fsm_dfa_t *dfa, const fsm_state_t *state) {
+    for (size_t i = 0; i < dfa->num_states; ++i) {
+        if (dfa->states[i] == state) {
+            return (int)i;
+        }
+    }
+    if (dfa->num_states >= FSM_DFA_MAX_STATES) {
+        return -1;
+    }
+    dfa->states[dfa->num_states] = state;
+    return (int)dfa->num_states++;
+}
+
+static const fsm_transition_t *dfa_transition(fsm_t *fsm, const fsm_state_t *state, int event) {
+    for (const fsm_state_t *s = state; s != NULL; s = s->parent) {
+        for (size_t i = 0; i < fsm->num_transitions; ++i) {
+            if (fsm->transitions[i].source_state == s && fsm->transitions[i].event == event) {
+                return &fsm->transitions[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Same paths as exit_state/enter_state */
+static int dfa_has_actions(const fsm_state_t *state, const fsm_state_t *lca, const fsm_state_t *target) {
+    for (const fsm_state_t *s = state; s != lca && s != NULL; s = s->parent) {
+        if (s->exit_action) {
+            return 1;
+        }
+    }
+    for (const fsm_state_t *s = target; s != lca && s != NULL; s = s->parent) {
+        if (s->entry_action) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int fsm_dfa_compile(fsm_t *fsm, fsm_dfa_t *dfa) {
+    dfa->num_states = 0;
+    fsm->dfa = NULL;
+
+    for (int symbol = 0; symbol < FSM_DFA_SYMBOLS; ++symbol) {
+        dfa->feed[FSM_DFA_MAX_STATES][symbol] = (uint16_t)DFA_SENTINEL;
+    }
+
+    if (dfa_row(dfa, fsm->current_state) < 0) {
+        return -1;
+    }
+
+    // Rows are added while walking them, only reachable states get one
+    for (size_t row = 0; row < dfa->num_states; ++row) {
+        const fsm_state_t *state = dfa->states[row];
+
+        for (int symbol = 0; symbol < FSM_DFA_SYMBOLS; ++symbol) {
+            const fsm_transition_t *t = dfa_transition(fsm, state, symbol);
+            const fsm_state_t *target, *lca;
+            int next;
+
+            if (t == NULL) {
+                dfa->next[row][symbol] = (uint16_t)DFA_ROW(row);
+                dfa->feed[row][symbol] = (uint16_t)DFA_ROW(row);
+                continue;
+            }
+
+            target = t->target_state;
+            while (target->default_substate) {
+                target = target->default_substate;
+            }
+            lca = find_lca((fsm_state_t *)state, t->target_state);
+
+            next = dfa_row(dfa, target);
+            if (next < 0) {
+                return -1;
+            }
+            dfa->next[row][symbol] = (uint16_t)DFA_ROW(next);
+            dfa->feed[row][symbol] = dfa_has_actions(state, lca, target) ? (uint16_t)DFA_SENTINEL : (uint16_t)DFA_ROW(next);
+        }
+    }
+
+    fsm->dfa = dfa;
+    return 0;
+}
+
+ptrdiff_t fsm_feed(fsm_t *fsm, const uint8_t *symbols, size_t n) {
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+    const fsm_dfa_t *dfa = fsm->dfa;
+    const uint16_t *feed;
+    size_t offset;
+    size_t i = 0;
+    int index;
+
+    if (dfa == NULL) {
+        return -1;
+    }
+    index = fsm_dfa_index(dfa, fsm->current_state->state_id);
+    if (index < 0 || dfa->states[index] != fsm->current_state) {
+        return -1;
+    }
+    if (internal->terminate) {
+        return 0;
+    }
+
+    feed = &dfa->feed[0][0];
+    offset = DFA_ROW(index);
+
+    while (i < n) {
+        size_t end = (n - i > DFA_CHUNK) ? i + DFA_CHUNK : n;
+        size_t start = offset;
+
+        /* Fast path: one load per symbol, the sentinel absorbs the chunk */
+        for (size_t j = i; j < end; ++j) {
+            offset = feed[offset + symbols[j]];
+        }
+        if (offset != DFA_SENTINEL) {
+            i = end;
+            continue;
+        }
+
+        /* A transition runs actions, replay the chunk stopping on them */
+        offset = start;
+        for (; i < end; ++i) {
+            size_t next = feed[offset + symbols[i]];
+
+            if (next == DFA_SENTINEL) {
+                fsm->current_state = (fsm_state_t *)dfa->states[DFA_INDEX(offset)];
+                handle_event(fsm, symbols[i], (void *)&symbols[i]);
+
+                if (internal->terminate) {
+                    return (ptrdiff_t)(i + 1);
+                }
+                next = dfa->next[DFA_INDEX(offset)][symbols[i]];
+            }
+            offset = next;
+        }
+    }
+
+    fsm->current_state = (fsm_state_t *)dfa->states[DFA_INDEX(offset)];
+    return (ptrdiff_t)n;
+}
+
+void fsm_dfa_feed_streams(const fsm_dfa_t *dfa, const uint8_t *const symbols[], size_t n, uint8_t states[], size_t num_streams) {
+    const uint16_t *next = &dfa->next[0][0];
+    size_t k = 0;
+
+    /* Independent lookups of 4 streams overlap their load latency */
+    for (; k + 4 <= num_streams; k += 4) {
+        const uint8_t *p0 = symbols[k], *p1 = symbols[k + 1], *p2 = symbols[k + 2], *p3 = symbols[k + 3];
+        size_t s0 = DFA_ROW(states[k]), s1 = DFA_ROW(states[k + 1]);
+        size_t s2 = DFA_ROW(states[k + 2]), s3 = DFA_ROW(states[k + 3]);
+
+        for (size_t i = 0; i < n; ++i) {
+            s0 = next[s0 + p0[i]];
+            s1 = next[s1 + p1[i]];
+            s2 = next[s2 + p2[i]];
+            s3 = next[s3 + p3[i]];
+        }
+
+        states[k] = (uint8_t)DFA_INDEX(s0);
+        states[k + 1] = (uint8_t)DFA_INDEX(s1);
+        states[k + 2] = (uint8_t)DFA_INDEX(s2);
+        states[k + 3] = (uint8_t)DFA_INDEX(s3);
+    }
+
+    for (; k < num_streams; ++k) {
+        const uint8_t *p = symbols[k];
+        size_t s = DFA_ROW(states[k]);
+
+        for (size_t i = 0; i < n; ++i) {
+            s = next[s + p[i]];
+        }
+        states[k] = (uint8_t)DFA_INDEX(s);
+    }
+}
+
+int fsm_dfa_index(const fsm_dfa_t *dfa, int state_id) {
+    for (size_t i = 0; i < dfa->num_states; ++i) {
+        if (dfa->states[i]->state_id == state_id) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int fsm_dfa_state_id(const fsm_dfa_t *dfa, uint8_t index) {
+    if (index >= dfa->num_states) {
+        return -1;
+    }
+    return dfa->states[index]->state_id;
+}
+
 int fsm_run(fsm_t *fsm)
 {
     struct internal_ctx *const internal = (void *)&fsm->internal;
@@ -165,5 +655,9 @@ int fsm_has_pending_events(fsm_t *fsm) {
 }
 
 void fsm_flush_events(fsm_t *fsm) {
-    ringbuff_flush(&fsm->event_queue);
+    struct fsm_events_t event;
+
+    while (queue_get(fsm, &event) == 0) {
+        event_release(&event);
+    }
 }
\ No newline at end of file
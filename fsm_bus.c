@@ -0,0 +1,231 @@
+/**
+ * @file fsm_bus.c
+ * @author Mauro Medina
+ * @brief Publish/subscribe event bus to broadcast events to many fsm
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "fsm_bus.h"
+
+#if (FSM_BUS_BATCH_SIZE & (FSM_BUS_BATCH_SIZE - 1)) != 0
+#error "FSM_BUS_BATCH_SIZE must be a power of 2"
+#endif
+
+#define BATCH_MASK (FSM_BUS_BATCH_SIZE - 1)
+
+static void msg_release(fsm_ref_t *ref) {
+    struct fsm_bus_msg *msg = (struct fsm_bus_msg *)ref;
+
+    if (msg->release) {
+        msg->release(msg->data);
+    }
+    __atomic_store_n(&msg->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static struct fsm_bus_msg *msg_alloc(struct fsm_bus *bus) {
+    for (size_t i = 0; i < FSM_BUS_MAX_MSGS; ++i) {
+        int expected = 0;
+
+        if (__atomic_compare_exchange_n(&bus->msgs[i].in_use, &expected, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return &bus->msgs[i];
+        }
+    }
+    return NULL;
+}
+
+static int is_subscribed(struct fsm_bus *bus, fsm_t *fsm, int event) {
+    for (size_t w = 0; w < FSM_BUS_MAX_WORKERS; ++w) {
+        for (int16_t i = bus->heads[event][w]; i >= 0; i = bus->subs[i].next) {
+            if (bus->subs[i].fsm == fsm) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void fsm_bus_init(struct fsm_bus *bus) {
+    memset(bus, 0, sizeof(*bus));
+
+    for (size_t e = 0; e < FSM_MAX_EVENT_ID; ++e) {
+        for (size_t w = 0; w < FSM_BUS_MAX_WORKERS; ++w) {
+            bus->heads[e][w] = -1;
+        }
+    }
+
+    for (size_t i = 0; i < FSM_BUS_MAX_SUBSCRIBERS; ++i) {
+        bus->subs[i].next = (i + 1 < FSM_BUS_MAX_SUBSCRIBERS) ? (int16_t)(i + 1) : -1;
+    }
+    bus->free_sub = 0;
+
+    for (size_t i = 0; i < FSM_BUS_MAX_MSGS; ++i) {
+        bus->msgs[i].ref.release = msg_release;
+    }
+}
+
+/* Returns 1 if the subscription was added, 0 if it already existed */
+static int subscribe(struct fsm_bus *bus, fsm_t *fsm, int event, unsigned worker) {
+    int16_t sub;
+
+    if (event < 0 || event >= FSM_MAX_EVENT_ID || worker >= FSM_BUS_MAX_WORKERS) {
+        return -1;
+    }
+    if (is_subscribed(bus, fsm, event)) {
+        return 0;
+    }
+
+    sub = bus->free_sub;
+    if (sub < 0) {
+        return -1;
+    }
+    bus->free_sub = bus->subs[sub].next;
+
+    bus->subs[sub].fsm  = fsm;
+    bus->subs[sub].next = bus->heads[event][worker];
+    bus->heads[event][worker] = sub;
+
+    return 1;
+}
+
+static void unsubscribe(struct fsm_bus *bus, fsm_t *fsm, int event) {
+    for (size_t w = 0; w < FSM_BUS_MAX_WORKERS; ++w) {
+        int16_t *link = &bus->heads[event][w];
+
+        while (*link >= 0) {
+            int16_t sub = *link;
+
+            if (bus->subs[sub].fsm == fsm) {
+                *link = bus->subs[sub].next;
+                bus->subs[sub].fsm  = NULL;
+                bus->subs[sub].next = bus->free_sub;
+                bus->free_sub = sub;
+            } else {
+                link = &bus->subs[sub].next;
+            }
+        }
+    }
+}
+
+int fsm_bus_subscribe(struct fsm_bus *bus, fsm_t *fsm, int event, unsigned worker) {
+    return subscribe(bus, fsm, event, worker) < 0 ? -1 : 0;
+}
+
+int fsm_bus_subscribe_fsm(struct fsm_bus *bus, fsm_t *fsm, unsigned worker) {
+    uint32_t added[FSM_MASK_WORDS] = {0};
+
+    if (worker >= FSM_BUS_MAX_WORKERS) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < fsm->num_transitions; ++i) {
+        int event = fsm->transitions[i].event;
+        int ret;
+
+        // Skip the [0] = {0} entry of FSM_TRANSITIONS_INIT and unpublishable events
+        if (fsm->transitions[i].source_state == NULL || event < 0 || event >= FSM_MAX_EVENT_ID) {
+            continue;
+        }
+
+        ret = subscribe(bus, fsm, event, worker);
+        if (ret < 0) {
+            /* Roll back what this call added */
+            for (int e = 0; e < FSM_MAX_EVENT_ID; ++e) {
+                if (added[e / 32] & (1u << (e % 32))) {
+                    unsubscribe(bus, fsm, e);
+                }
+            }
+            return -1;
+        }
+        if (ret > 0) {
+            added[event / 32] |= 1u << (event % 32);
+        }
+    }
+    return 0;
+}
+
+void fsm_bus_unsubscribe_fsm(struct fsm_bus *bus, fsm_t *fsm) {
+    for (int e = 0; e < FSM_MAX_EVENT_ID; ++e) {
+        unsubscribe(bus, fsm, e);
+    }
+}
+
+int fsm_bus_publish(struct fsm_bus *bus, int event, void *data, void (*release)(void *data)) {
+    struct fsm_bus_msg *msg;
+    int queued = 0;
+
+    if (event < 0 || event >= FSM_MAX_EVENT_ID) {
+        return -1;
+    }
+
+    /* Only workers free slots concurrently, a batch with room keeps it */
+    for (size_t w = 0; w < FSM_BUS_MAX_WORKERS; ++w) {
+        struct fsm_bus_worker *worker = &bus->workers[w];
+
+        if (bus->heads[event][w] >= 0
+            && worker->head - __atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE) >= FSM_BUS_BATCH_SIZE) {
+            return -1;
+        }
+    }
+
+    msg = msg_alloc(bus);
+    if (msg == NULL) {
+        return -1;
+    }
+    msg->event     = event;
+    msg->data      = data;
+    msg->release   = release;
+    msg->ref.count = 1;
+
+    for (size_t w = 0; w < FSM_BUS_MAX_WORKERS; ++w) {
+        struct fsm_bus_worker *worker = &bus->workers[w];
+
+        if (bus->heads[event][w] >= 0) {
+            fsm_ref_get(&msg->ref);
+            worker->batch[worker->head & BATCH_MASK] = msg;
+            __atomic_store_n(&worker->head, worker->head + 1, __ATOMIC_RELEASE);
+            queued++;
+        }
+    }
+
+    /* Drop the publisher reference, releases right away without subscribers */
+    fsm_ref_put(&msg->ref);
+
+    return queued;
+}
+
+int fsm_bus_deliver(struct fsm_bus *bus, unsigned worker) {
+    struct fsm_bus_worker *w;
+    uint32_t head, tail;
+    int delivered = 0;
+
+    if (worker >= FSM_BUS_MAX_WORKERS) {
+        return 0;
+    }
+
+    w = &bus->workers[worker];
+    head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+    tail = w->tail;
+
+    while (tail != head) {
+        struct fsm_bus_msg *msg = w->batch[tail & BATCH_MASK];
+
+        for (int16_t i = bus->heads[msg->event][worker]; i >= 0; i = bus->subs[i].next) {
+            fsm_dispatch_ref(bus->subs[i].fsm, msg->event, msg->data, &msg->ref);
+        }
+        fsm_ref_put(&msg->ref);
+
+        /* Give the slot back to the publisher */
+        __atomic_store_n(&w->tail, ++tail, __ATOMIC_RELEASE);
+        delivered++;
+    }
+
+    return delivered;
+}
@@ -0,0 +1,365 @@
+/**
+ * @file fsm_image.c
+ * @author Mauro Medina
+ * @brief Compiled FSM image builder and loader
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FSM_IMAGE_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "fsm_image.h"
+
+static int symbol_id(const fsm_image_action_t *symbols, size_t num_symbols, fsm_image_action_t action) {
+    if (action == NULL) {
+        return FSM_IMAGE_SYM_NONE;
+    }
+    for (size_t i = FSM_IMAGE_SYM_NONE + 1; i < num_symbols; ++i) {
+        if (symbols[i] == action) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int state_index(const fsm_state_t *states, size_t num_states, const fsm_state_t *state) {
+    if (state == NULL) {
+        return 0;
+    }
+    if (state < states || state >= states + num_states) {
+        return -1;
+    }
+    return (int)(state - states);
+}
+
+int fsm_image_build(void *buf, size_t size,
+                    const fsm_state_t *states, size_t num_states,
+                    const fsm_transition_t *transitions, size_t num_transitions,
+                    const fsm_image_action_t *symbols, size_t num_symbols) {
+    struct fsm_image_header *header = buf;
+    struct fsm_image_state *img_states;
+    fsm_range_t *img_index;
+    struct fsm_image_transition *img_transitions;
+    size_t used_transitions = 0;
+    size_t image_size;
+
+    if (symbols == NULL) {
+        num_symbols = 0;
+    }
+    if (states == NULL || num_states == 0 || num_states > UINT16_MAX || num_symbols > UINT16_MAX) {
+        return -1;
+    }
+
+    // The [0] = {0} entry of FSM_TRANSITIONS_INIT is not a transition
+    for (size_t i = 0; i < num_transitions; ++i) {
+        if (transitions[i].source_state != NULL) {
+            used_transitions++;
+        }
+    }
+
+    image_size = sizeof(struct fsm_image_header)
+               + num_states * sizeof(struct fsm_image_state)
+               + num_states * sizeof(fsm_range_t)
+               + used_transitions * sizeof(struct fsm_image_transition);
+
+    if (buf == NULL) {
+        return (int)image_size;
+    }
+    if (size < image_size || ((uintptr_t)buf & 3u) != 0) {
+        return -1;
+    }
+
+    memset(buf, 0, image_size);
+    header->magic              = FSM_IMAGE_MAGIC;
+    header->version            = FSM_IMAGE_VERSION;
+    header->header_size        = sizeof(struct fsm_image_header);
+    header->image_size         = (uint32_t)image_size;
+    header->num_states         = (uint32_t)num_states;
+    header->num_transitions    = (uint32_t)used_transitions;
+    header->num_symbols        = (uint32_t)num_symbols;
+    header->states_offset      = sizeof(struct fsm_image_header);
+    header->index_offset       = header->states_offset + (uint32_t)(num_states * sizeof(struct fsm_image_state));
+    header->transitions_offset = header->index_offset + (uint32_t)(num_states * sizeof(fsm_range_t));
+
+    img_states      = (struct fsm_image_state *)((uint8_t *)buf + header->states_offset);
+    img_index       = (fsm_range_t *)((uint8_t *)buf + header->index_offset);
+    img_transitions = (struct fsm_image_transition *)((uint8_t *)buf + header->transitions_offset);
+
+    // States and hierarchy
+    for (size_t i = 1; i < num_states; ++i) {
+        const fsm_state_t *s = &states[i];
+        int parent  = state_index(states, num_states, s->parent);
+        int sub     = state_index(states, num_states, s->default_substate);
+        int entry   = symbol_id(symbols, num_symbols, s->entry_action);
+        int run     = symbol_id(symbols, num_symbols, s->run_action);
+        int exit    = symbol_id(symbols, num_symbols, s->exit_action);
+        int depth   = 0;
+        int chain   = 0;
+
+        /* The lookup index is addressed by state id */
+        if (s->state_id != (int)i || parent < 0 || sub < 0 || entry < 0 || run < 0 || exit < 0) {
+            return -1;
+        }
+        for (const fsm_state_t *p = s->parent; p != NULL; p = p->parent) {
+            if (++depth >= MAX_HIERARCHY_DEPTH) {
+                return -1;
+            }
+        }
+        for (const fsm_state_t *d = s->default_substate; d != NULL; d = d->default_substate) {
+            if (++chain >= MAX_HIERARCHY_DEPTH) {
+                return -1;
+            }
+        }
+
+        img_states[i].state_id         = s->state_id;
+        img_states[i].parent           = (uint16_t)parent;
+        img_states[i].default_substate = (uint16_t)sub;
+        img_states[i].entry_sym        = (uint16_t)entry;
+        img_states[i].run_sym          = (uint16_t)run;
+        img_states[i].exit_sym         = (uint16_t)exit;
+        img_states[i].depth            = (uint16_t)depth;
+    }
+
+    // Lookup index: count per source, then prefix sums
+    for (size_t i = 0; i < num_transitions; ++i) {
+        int src;
+
+        if (transitions[i].source_state == NULL) {
+            continue;
+        }
+        src = state_index(states, num_states, transitions[i].source_state);
+        if (src <= 0 || state_index(states, num_states, transitions[i].target_state) <= 0) {
+            return -1;
+        }
+        img_index[src].num++;
+    }
+    for (size_t i = 1, first = 0; i < num_states; ++i) {
+        img_index[i].first = (uint32_t)first;
+        first += img_index[i].num;
+        img_index[i].num = 0;
+    }
+
+    // Transitions grouped by source, keeping the table order inside a group
+    for (size_t i = 0; i < num_transitions; ++i) {
+        fsm_range_t *range;
+        struct fsm_image_transition *t;
+
+        if (transitions[i].source_state == NULL) {
+            continue;
+        }
+        range = &img_index[transitions[i].source_state - states];
+        t = &img_transitions[range->first + range->num++];
+        t->event  = transitions[i].event;
+        t->source = (uint16_t)(transitions[i].source_state - states);
+        t->target = (uint16_t)(transitions[i].target_state - states);
+    }
+
+    return (int)image_size;
+}
+
+int fsm_image_save(const char *path, const void *image, size_t size) {
+    FILE *f = fopen(path, "wb");
+    int ret = 0;
+
+    if (f == NULL) {
+        return -1;
+    }
+    if (fwrite(image, 1, size, f) != size) {
+        ret = -1;
+    }
+    if (fclose(f) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int fsm_image_open(struct fsm_image *img, const void *buf, size_t size) {
+    const struct fsm_image_header *header = buf;
+    uint64_t states_end, index_end, transitions_end;
+
+    memset(img, 0, sizeof(*img));
+
+    if (buf == NULL || ((uintptr_t)buf & 3u) != 0 || size < sizeof(struct fsm_image_header)) {
+        return -1;
+    }
+    if (header->magic != FSM_IMAGE_MAGIC || header->version != FSM_IMAGE_VERSION
+        || header->header_size != sizeof(struct fsm_image_header) || header->image_size > size
+        || header->num_states == 0) {
+        return -1;
+    }
+
+    states_end      = (uint64_t)header->states_offset + (uint64_t)header->num_states * sizeof(struct fsm_image_state);
+    index_end       = (uint64_t)header->index_offset + (uint64_t)header->num_states * sizeof(fsm_range_t);
+    transitions_end = (uint64_t)header->transitions_offset + (uint64_t)header->num_transitions * sizeof(struct fsm_image_transition);
+    if (header->states_offset < header->header_size || (header->states_offset & 3u) != 0
+        || (header->index_offset & 3u) != 0 || (header->transitions_offset & 3u) != 0
+        || states_end > header->image_size || index_end > header->image_size || transitions_end > header->image_size) {
+        return -1;
+    }
+
+    img->header      = header;
+    img->states      = (const struct fsm_image_state *)((const uint8_t *)buf + header->states_offset);
+    img->index       = (const fsm_range_t *)((const uint8_t *)buf + header->index_offset);
+    img->transitions = (const struct fsm_image_transition *)((const uint8_t *)buf + header->transitions_offset);
+
+    return 0;
+}
+
+int fsm_image_map(struct fsm_image *img, const char *path) {
+#ifdef FSM_IMAGE_HAS_MMAP
+    struct stat st;
+    void *base;
+    int fd = open(path, O_RDONLY);
+
+    memset(img, 0, sizeof(*img));
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    if (fsm_image_open(img, base, (size_t)st.st_size) != 0) {
+        munmap(base, (size_t)st.st_size);
+        return -1;
+    }
+    img->map_base = base;
+    img->map_size = (size_t)st.st_size;
+
+    return 0;
+#else
+    (void)path;
+    memset(img, 0, sizeof(*img));
+    return -1;
+#endif
+}
+
+void fsm_image_unmap(struct fsm_image *img) {
+#ifdef FSM_IMAGE_HAS_MMAP
+    if (img->map_base != NULL) {
+        munmap(img->map_base, img->map_size);
+    }
+#endif
+    memset(img, 0, sizeof(*img));
+}
+
+static int symbol_valid(size_t num_symbols, uint16_t sym) {
+    return sym == FSM_IMAGE_SYM_NONE || sym < num_symbols;
+}
+
+static fsm_image_action_t symbol_get(const fsm_image_action_t *symbols, uint16_t sym) {
+    return sym == FSM_IMAGE_SYM_NONE ? NULL : symbols[sym];
+}
+
+/* Walks the hierarchy of a state record, at most MAX_HIERARCHY_DEPTH steps */
+static int state_check(const struct fsm_image *img, uint32_t i) {
+    const struct fsm_image_state *states = img->states;
+    uint32_t num_states = img->header->num_states;
+    uint16_t s;
+    int depth;
+
+    if (states[i].state_id != (int32_t)i || states[i].parent >= num_states || states[i].default_substate >= num_states) {
+        return -1;
+    }
+
+    depth = 0;
+    for (s = states[i].parent; s != 0; s = states[s].parent) {
+        if (s >= num_states || ++depth >= MAX_HIERARCHY_DEPTH) {
+            return -1;
+        }
+    }
+    if (depth != states[i].depth) {
+        return -1;
+    }
+
+    depth = 0;
+    for (s = states[i].default_substate; s != 0; s = states[s].default_substate) {
+        if (s >= num_states || ++depth >= MAX_HIERARCHY_DEPTH) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int fsm_image_init(fsm_t *fsm, const struct fsm_image *img,
+                   const fsm_image_action_t *symbols, size_t num_symbols,
+                   fsm_state_t *states, size_t max_states,
+                   fsm_transition_t *transitions, size_t max_transitions,
+                   int initial_state, void *initial_data) {
+    const struct fsm_image_header *header = img->header;
+    uint64_t indexed = 0;
+
+    if (symbols == NULL) {
+        num_symbols = 0;
+    }
+    if (header == NULL || header->num_states > max_states || header->num_transitions > max_transitions
+        || initial_state <= 0 || (uint32_t)initial_state >= header->num_states) {
+        return -1;
+    }
+
+    memset(&states[0], 0, sizeof(states[0]));
+    for (uint32_t i = 1; i < header->num_states; ++i) {
+        const struct fsm_image_state *s = &img->states[i];
+        const fsm_range_t *range = &img->index[i];
+
+        if (state_check(img, i) != 0
+            || !symbol_valid(num_symbols, s->entry_sym) || !symbol_valid(num_symbols, s->run_sym)
+            || !symbol_valid(num_symbols, s->exit_sym)
+            || (uint64_t)range->first + range->num > header->num_transitions) {
+            return -1;
+        }
+        indexed += range->num;
+
+        states[i].state_id         = s->state_id;
+        states[i].parent           = s->parent ? &states[s->parent] : NULL;
+        states[i].default_substate = s->default_substate ? &states[s->default_substate] : NULL;
+        states[i].entry_action     = symbol_get(symbols, s->entry_sym);
+        states[i].run_action       = symbol_get(symbols, s->run_sym);
+        states[i].exit_action      = symbol_get(symbols, s->exit_sym);
+    }
+
+    for (uint32_t i = 0; i < header->num_transitions; ++i) {
+        const struct fsm_image_transition *t = &img->transitions[i];
+
+        if (t->source == 0 || t->target == 0 || t->source >= header->num_states || t->target >= header->num_states) {
+            return -1;
+        }
+        /* Every transition must be inside the index range of its source */
+        if (i < img->index[t->source].first || i - img->index[t->source].first >= img->index[t->source].num) {
+            return -1;
+        }
+
+        transitions[i].source_state = &states[t->source];
+        transitions[i].event        = t->event;
+        transitions[i].target_state = &states[t->target];
+    }
+    if (indexed != header->num_transitions) {
+        return -1;
+    }
+
+    fsm_init(fsm, transitions, header->num_transitions, &states[initial_state], initial_data);
+    fsm_index_set(fsm, img->index, header->num_states);
+
+    return 0;
+}
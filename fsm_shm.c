@@ -0,0 +1,249 @@
+/**
+ * @file fsm_shm.c
+ * @author Mauro Medina
+ * @brief Cross-process events queue in POSIX shared memory (Linux)
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fsm_shm.h"
+
+#if (FSM_SHM_CAPACITY & (FSM_SHM_CAPACITY - 1)) != 0
+#error "FSM_SHM_CAPACITY must be a power of 2"
+#endif
+
+#define SLOT_MASK (FSM_SHM_CAPACITY - 1)
+
+static long futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout) {
+    /* Not FUTEX_PRIVATE: waiter and waker are different processes */
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static void slot_release(fsm_ref_t *ref) {
+    struct fsm_shm_ref *slot_ref = (struct fsm_shm_ref *)ref;
+    struct fsm_shm_slot *slot = &slot_ref->shm->seg->slots[slot_ref->pos & SLOT_MASK];
+
+    /* Hand the slot back to the producers for the next lap */
+    __atomic_store_n(&slot->seq, slot_ref->pos + FSM_SHM_CAPACITY, __ATOMIC_RELEASE);
+}
+
+static int slot_ready(struct fsm_shm *shm) {
+    struct fsm_shm_slot *slot = &shm->seg->slots[shm->tail & SLOT_MASK];
+
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == shm->tail + 1;
+}
+
+static int shm_map(struct fsm_shm *shm, int fd) {
+    void *base = mmap(NULL, sizeof(struct fsm_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    shm->seg = base;
+    return 0;
+}
+
+int fsm_shm_create(struct fsm_shm *shm, const char *name) {
+    struct fsm_shm_segment *seg;
+    int fd;
+
+    memset(shm, 0, sizeof(*shm));
+
+    /* Never reuse a segment: producers may still have it mapped */
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    /* The name was created here, a failed create must not leave it behind */
+    if (ftruncate(fd, sizeof(struct fsm_shm_segment)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    if (shm_map(shm, fd) != 0) {
+        shm_unlink(name);
+        return -1;
+    }
+
+    seg = shm->seg;
+    for (uint32_t i = 0; i < FSM_SHM_CAPACITY; ++i) {
+        seg->slots[i].seq            = i;
+        seg->slots[i].payload_offset = (uint32_t)offsetof(struct fsm_shm_segment, payloads[i]);
+        shm->refs[i].ref.release     = slot_release;
+        shm->refs[i].shm             = shm;
+    }
+    seg->capacity     = FSM_SHM_CAPACITY;
+    seg->payload_size = FSM_SHM_PAYLOAD_SIZE;
+    seg->size         = sizeof(struct fsm_shm_segment);
+    shm->owner        = 1;
+
+    /* Producers check the magic, publish it last */
+    __atomic_store_n(&seg->magic, FSM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int fsm_shm_open(struct fsm_shm *shm, const char *name) {
+    struct stat st;
+    int fd;
+
+    memset(shm, 0, sizeof(*shm));
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct fsm_shm_segment)) {
+        close(fd);
+        return -1;
+    }
+    if (shm_map(shm, fd) != 0) {
+        return -1;
+    }
+
+    if (__atomic_load_n(&shm->seg->magic, __ATOMIC_ACQUIRE) != FSM_SHM_MAGIC
+        || shm->seg->capacity != FSM_SHM_CAPACITY || shm->seg->payload_size != FSM_SHM_PAYLOAD_SIZE
+        || shm->seg->size != sizeof(struct fsm_shm_segment)) {
+        fsm_shm_close(shm);
+        return -1;
+    }
+
+    return 0;
+}
+
+void fsm_shm_close(struct fsm_shm *shm) {
+    if (shm->seg != NULL) {
+        munmap(shm->seg, sizeof(struct fsm_shm_segment));
+    }
+    shm->seg = NULL;
+}
+
+int fsm_shm_unlink(const char *name) {
+    return shm_unlink(name);
+}
+
+int fsm_remote_dispatch(struct fsm_shm *shm, int event, const void *data, size_t len) {
+    struct fsm_shm_segment *seg = shm->seg;
+    struct fsm_shm_slot *slot;
+    uint32_t pos;
+
+    if (len > FSM_SHM_PAYLOAD_SIZE || (len > 0 && data == NULL)) {
+        return -1;
+    }
+
+    /* Claim a slot: bounded MPMC ring, the slot sequence tells its lap */
+    pos = __atomic_load_n(&seg->head, __ATOMIC_RELAXED);
+    for (;;) {
+        int32_t diff;
+
+        slot = &seg->slots[pos & SLOT_MASK];
+        diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&seg->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&seg->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->event = event;
+    slot->len   = (uint32_t)len;
+    if (len > 0) {
+        memcpy((uint8_t *)seg + slot->payload_offset, data, len);
+    }
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /* Pairs with the fence in fsm_shm_wait: either the consumer sees the slot
+     * or we see it waiting */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&seg->waiters, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&seg->futex, 1, __ATOMIC_RELEASE);
+        futex(&seg->futex, FUTEX_WAKE, 1, NULL);
+    }
+
+    return 0;
+}
+
+int fsm_shm_poll(struct fsm_shm *shm, fsm_t *fsm) {
+    struct fsm_shm_segment *seg = shm->seg;
+    int moved = 0;
+
+    if (!shm->owner) {
+        return 0;
+    }
+
+    /* Leave the events in the ring while the fsm queue is full, so producers
+     * see the backpressure instead of the fsm dropping its oldest events */
+    while (slot_ready(shm) && ringbuff_num(&fsm->event_queue) < FSM_MAX_EVENTS - 1) {
+        uint32_t index = shm->tail & SLOT_MASK;
+        struct fsm_shm_slot *slot = &seg->slots[index];
+        struct fsm_shm_ref *slot_ref = &shm->refs[index];
+        uint32_t len = slot->len;
+        void *data = NULL;
+
+        /* The segment is writable by other processes, never trust it: the
+         * payload must be the slot's own one */
+        if (len > 0 && len <= FSM_SHM_PAYLOAD_SIZE
+            && slot->payload_offset == offsetof(struct fsm_shm_segment, payloads[index])) {
+            data = seg->payloads[index];
+        }
+
+        slot_ref->pos = shm->tail;
+        shm->tail++;
+
+        /* Hold a reference while dispatching, the event may be dropped or coalesced */
+        slot_ref->ref.count = 1;
+        fsm_dispatch_ref(fsm, slot->event, data, &slot_ref->ref);
+        fsm_ref_put(&slot_ref->ref);
+
+        moved++;
+    }
+
+    return moved;
+}
+
+int fsm_shm_wait(struct fsm_shm *shm, int timeout_ms) {
+    struct fsm_shm_segment *seg = shm->seg;
+    struct timespec ts, *timeout = NULL;
+    uint32_t val;
+
+    if (slot_ready(shm)) {
+        return 1;
+    }
+
+    if (timeout_ms >= 0) {
+        ts.tv_sec  = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        timeout = &ts;
+    }
+
+    val = __atomic_load_n(&seg->futex, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&seg->waiters, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (!slot_ready(shm)) {
+        futex(&seg->futex, FUTEX_WAIT, val, timeout);
+    }
+
+    __atomic_store_n(&seg->waiters, 0, __ATOMIC_RELAXED);
+
+    return slot_ready(shm);
+}
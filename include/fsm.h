@@ -24,6 +24,34 @@
 #define FSM_MAX_EVENTS 64
 #endif
 
+/* Event coalescing (fsm_coalesce_set), adds a pending slots table to every
+ * fsm. Changes fsm_t, must be the same in the whole project */
+#ifndef FSM_COALESCE_EVENTS
+#define FSM_COALESCE_EVENTS 0
+#endif
+
+/* Events with id >= FSM_MAX_EVENT_ID can't have per event policies */
+#ifndef FSM_MAX_EVENT_ID
+#define FSM_MAX_EVENT_ID 64
+#endif
+
+/* Per state handled events mask (O(1) rejection, fsm_early_drop_set), adds
+ * FSM_MAX_STATES masks to every fsm. Changes fsm_t, must be the same in the
+ * whole project */
+#ifndef FSM_HANDLED_MASK
+#define FSM_HANDLED_MASK 0
+#endif
+
+/* States with id >= FSM_MAX_STATES disable the handled events mask */
+#ifndef FSM_MAX_STATES
+#define FSM_MAX_STATES 32
+#endif
+
+/* Dense table rows for fsm_feed, 255 max */
+#ifndef FSM_DFA_MAX_STATES
+#define FSM_DFA_MAX_STATES 32
+#endif
+
 #ifndef MAX_HIERARCHY_DEPTH 
 #define MAX_HIERARCHY_DEPTH  8
 #endif
@@ -49,6 +77,18 @@
  */
 #define FSM_EV_FIRST 0
 
+/**
+ * @brief Words of a per state handled events mask
+ * 
+ */
+#define FSM_MASK_WORDS ((FSM_MAX_EVENT_ID + 31) / 32)
+
+/**
+ * @brief Number of symbols of a dense table row
+ * 
+ */
+#define FSM_DFA_SYMBOLS 256
+
 //----------------------------------------------------------------------
 //	MACROS
 //----------------------------------------------------------------------
@@ -102,6 +142,8 @@
 #define FSM_TRANSITIONS_SIZE(name) (sizeof(name##_transitions)/sizeof(name##_transitions[0]))
 
 #define FSM_STATE_GET(name, id)   name##_states[id]
+#define FSM_STATES_GET(name)      name##_states
+#define FSM_STATES_SIZE(name)     (sizeof(name##_states)/sizeof(name##_states[0]))
 //----------------------------------------------------------------------
 //	DECLARATIONS
 //----------------------------------------------------------------------
@@ -112,8 +154,21 @@ enum fsm_action_e
     ACTION_EXIT
 };
 
+/**
+ * @brief Event coalescing policies, applied by fsm_dispatch when the same
+ * event is still pending in the queue. A coalesced event takes one queue slot.
+ */
+enum fsm_coalesce_e
+{
+    FSM_COALESCE_NONE = 0,      // Every event is queued
+    FSM_COALESCE_REPLACE,       // The pending event takes the new data
+    FSM_COALESCE_KEEP_FIRST,    // The new event is dropped
+    FSM_COALESCE_COUNT          // The pending event keeps its data, repeats are counted (fsm_event_count)
+};
+
 typedef struct fsm_state_t fsm_state_t;
 typedef struct fsm_t fsm_t;
+typedef struct fsm_dfa fsm_dfa_t;
 
 struct fsm_state_t {
     int state_id;
@@ -130,10 +185,52 @@ typedef struct {
     fsm_state_t* target_state;
 } fsm_transition_t;
 
+/**
+ * @brief Transitions of one source state, in a table grouped by source
+ * 
+ */
+typedef struct {
+    uint32_t first;
+    uint32_t num;
+} fsm_range_t;
+
+/**
+ * @brief Reference counted event payload.
+ *
+ * @details Lets one payload be queued in several fsm without copies. Each
+ * queued event holds one reference, released when the event is processed,
+ * flushed or overwritten. release is called when the count reaches zero.
+ */
+typedef struct fsm_ref fsm_ref_t;
+
+struct fsm_ref {
+    int count;
+    void (*release)(fsm_ref_t *ref);
+};
+
 struct fsm_events_t
 {
     int event;
+#if FSM_COALESCE_EVENTS
+    uint16_t count;
+#endif
     void *data;
+    fsm_ref_t *ref;
+};
+
+/*
+ * Dense tables hold row offsets (row index * FSM_DFA_SYMBOLS), so a lookup is
+ * a single load: offset = table[offset + symbol].
+ */
+struct fsm_dfa {
+    // Next row offset per row and symbol
+    uint16_t next[FSM_DFA_MAX_STATES][FSM_DFA_SYMBOLS];
+    // Same as next, but transitions running entry/exit actions go to the last
+    // row, a sentinel that only leads to itself
+    uint16_t feed[FSM_DFA_MAX_STATES + 1][FSM_DFA_SYMBOLS];
+    // State of each row
+    const fsm_state_t *states[FSM_DFA_MAX_STATES];
+    size_t num_states;
 };
 
 struct fsm_t {
@@ -141,9 +238,29 @@ struct fsm_t {
     const fsm_transition_t *transitions;
     // Total number of transitions
     size_t num_transitions;
+    // Optional transitions index, indexed by source state id
+    const fsm_range_t *index;
+    size_t num_index;
     // Events ring buffer 
     struct ringbuff event_queue;
     struct fsm_events_t events_buff[FSM_MAX_EVENTS];
+#if FSM_COALESCE_EVENTS
+    // Coalescing policies table, indexed by event
+    const uint8_t *coalesce;
+    size_t num_coalesce;
+    // Queue slot + 1 of the pending coalescable events, 0 if none
+    uint16_t pending[FSM_MAX_EVENT_ID];
+    // Repeat count of the event being processed
+    int current_count;
+#endif
+#if FSM_HANDLED_MASK
+    // Events handled by each state or its ancestors, indexed by state id
+    uint32_t handled_mask[FSM_MAX_STATES][FSM_MASK_WORDS];
+#endif
+    // Events discarded without a transition
+    uint32_t rejected_events;
+    // Dense table used by fsm_feed
+    const fsm_dfa_t *dfa;
     // Current state running
     fsm_state_t* current_state;
     // Current data
@@ -169,6 +286,20 @@ struct fsm_t {
  */
 void fsm_init(fsm_t *fsm, const fsm_transition_t *transitions, size_t num_transitions, const fsm_state_t* initial_state, void *initial_data);
 
+/**
+ * @brief Sets a transitions index, so only the transitions of the current
+ * state and its ancestors are scanned.
+ * 
+ * @details The transitions table must be grouped by source state and
+ * index[state_id] hold the range of each source. States out of the index
+ * scan the whole table. Call after fsm_init.
+ * 
+ * @param fsm 
+ * @param index     Ranges table pointer, NULL to scan the whole table
+ * @param num_index Number of entries in the index
+ */
+void fsm_index_set(fsm_t *fsm, const fsm_range_t *index, size_t num_index);
+
 /**
  * @brief Dispatches an event to the state machine. It will be process when fsm_run is called.
  * 
@@ -178,6 +309,138 @@ void fsm_init(fsm_t *fsm, const fsm_transition_t *transitions, size_t num_transi
  */
 void fsm_dispatch(fsm_t *fsm, int event, void *data);
 
+/**
+ * @brief Dispatches an event with a shared payload. A reference is taken on ref
+ * and released once the event leaves the queue.
+ * 
+ * @param fsm 
+ * @param event 
+ * @param data 
+ * @param ref   Payload reference, NULL behaves as fsm_dispatch
+ */
+void fsm_dispatch_ref(fsm_t *fsm, int event, void *data, fsm_ref_t *ref);
+
+/**
+ * @brief Takes a reference on a shared payload.
+ * 
+ * @param ref 
+ */
+void fsm_ref_get(fsm_ref_t *ref);
+
+/**
+ * @brief Releases a reference on a shared payload.
+ * 
+ * @param ref 
+ */
+void fsm_ref_put(fsm_ref_t *ref);
+
+#if FSM_COALESCE_EVENTS
+/**
+ * @brief Sets the event coalescing policies.
+ * 
+ * @details Call after fsm_init. The table is indexed by event and holds
+ * fsm_coalesce_e values, events out of the table are never coalesced.
+ * 
+ * @param fsm 
+ * @param policies      Policies table pointer
+ * @param num_policies  Number of entries in the table
+ */
+void fsm_coalesce_set(fsm_t *fsm, const uint8_t *policies, size_t num_policies);
+
+/**
+ * @brief Gets how many times the event being processed was dispatched.
+ * 
+ * @details Only FSM_COALESCE_COUNT events can be greater than 1. Valid inside
+ * the entry and exit actions run by the event.
+ * 
+ * @param fsm 
+ * @return int 
+ */
+int fsm_event_count(fsm_t *fsm);
+#endif
+
+#if FSM_HANDLED_MASK
+/**
+ * @brief Enables dropping events in fsm_dispatch when the current state and
+ * its ancestors have no transition for them, so they never reach the queue.
+ * 
+ * @details The check uses the state at dispatch time: an event dispatched
+ * behind a pending transition is dropped if the current state can't handle it,
+ * even if the state it will be processed in could. Disabled by default,
+ * unhandled events are always discarded at dequeue time in O(1).
+ * 
+ * @param fsm 
+ * @param enable 
+ */
+void fsm_early_drop_set(fsm_t *fsm, int enable);
+#endif
+
+/**
+ * @brief Gets the number of events discarded because no transition handled them.
+ * 
+ * @param fsm 
+ * @return uint32_t 
+ */
+uint32_t fsm_rejected_events_get(fsm_t *fsm);
+
+/**
+ * @brief Compiles the fsm into a dense next-state table, indexed by state and
+ * symbol, and attaches it to the fsm for fsm_feed.
+ * 
+ * @details Events are the symbols 0..255. Rows are built for the current state
+ * and every state reachable from it. Call after fsm_init.
+ * 
+ * @param fsm 
+ * @param dfa   Table storage, must outlive the fsm
+ * @return int 0 on success, -1 if more than FSM_DFA_MAX_STATES states are reachable
+ */
+int fsm_dfa_compile(fsm_t *fsm, fsm_dfa_t *dfa);
+
+/**
+ * @brief Runs a buffer of symbols through the fsm, one event per symbol.
+ * 
+ * @details Bypasses the events queue. Transitions without entry/exit actions
+ * are a single table lookup, the others run their actions with a pointer to
+ * the symbol as data. Run actions are not called.
+ * 
+ * @param fsm 
+ * @param symbols 
+ * @param n 
+ * @return ptrdiff_t Number of symbols consumed, less than n if the fsm was
+ *                   terminated, -1 if there is no table or the current state is not in it
+ */
+ptrdiff_t fsm_feed(fsm_t *fsm, const uint8_t *symbols, size_t n);
+
+/**
+ * @brief Runs many independent streams through a dense table, interleaving the
+ * lookups. Actions are not called, only the final states are computed.
+ * 
+ * @param dfa 
+ * @param symbols       Streams, n symbols each
+ * @param n 
+ * @param states        In/out state index of each stream (fsm_dfa_index)
+ * @param num_streams 
+ */
+void fsm_dfa_feed_streams(const fsm_dfa_t *dfa, const uint8_t *const symbols[], size_t n, uint8_t states[], size_t num_streams);
+
+/**
+ * @brief Gets the dense table index of a state.
+ * 
+ * @param dfa 
+ * @param state_id 
+ * @return int Index, or -1 if the state is not in the table
+ */
+int fsm_dfa_index(const fsm_dfa_t *dfa, int state_id);
+
+/**
+ * @brief Gets the state ID of a dense table index.
+ * 
+ * @param dfa 
+ * @param index 
+ * @return int State ID, or -1 if the index is not in the table
+ */
+int fsm_dfa_state_id(const fsm_dfa_t *dfa, uint8_t index);
+
 /**
  * @brief Runs the state machine.
  * 
@@ -0,0 +1,155 @@
+/**
+ * @file fsm_bus.h
+ * @author Mauro Medina
+ * @brief Publish/subscribe event bus to broadcast events to many fsm
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_BUS_H
+#define FSM_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fsm.h"
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+#ifndef FSM_BUS_MAX_SUBSCRIBERS
+#define FSM_BUS_MAX_SUBSCRIBERS 64
+#endif
+
+/* Maximum number of published messages alive at the same time */
+#ifndef FSM_BUS_MAX_MSGS
+#define FSM_BUS_MAX_MSGS 16
+#endif
+
+#ifndef FSM_BUS_MAX_WORKERS
+#define FSM_BUS_MAX_WORKERS 1
+#endif
+
+/* Per worker pending messages, power of 2 */
+#ifndef FSM_BUS_BATCH_SIZE
+#define FSM_BUS_BATCH_SIZE 16
+#endif
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+struct fsm_bus_sub {
+    fsm_t *fsm;
+    int16_t next;
+};
+
+struct fsm_bus_msg {
+    // Must be first, shared by every fsm queue holding the message
+    fsm_ref_t ref;
+    int event;
+    void *data;
+    void (*release)(void *data);
+    int in_use;
+};
+
+/* Single producer (publisher) / single consumer (worker) ring */
+struct fsm_bus_worker {
+    // Written by fsm_bus_publish, own cache line
+    uint32_t head __attribute__((aligned(64)));
+    // Written by fsm_bus_deliver, own cache line
+    uint32_t tail __attribute__((aligned(64)));
+    struct fsm_bus_msg *batch[FSM_BUS_BATCH_SIZE];
+};
+
+/*
+ * Concurrency: fsm_bus_publish may run in one thread (the publisher) at the
+ * same time as fsm_bus_deliver runs in each worker thread, every worker
+ * delivering only to its own fsm. Init, subscribe and unsubscribe must not run
+ * concurrently with any other call.
+ */
+struct fsm_bus {
+    // Subscribers lists per event and worker, -1 terminated
+    int16_t heads[FSM_MAX_EVENT_ID][FSM_BUS_MAX_WORKERS];
+    struct fsm_bus_sub subs[FSM_BUS_MAX_SUBSCRIBERS];
+    int16_t free_sub;
+    struct fsm_bus_msg msgs[FSM_BUS_MAX_MSGS];
+    struct fsm_bus_worker workers[FSM_BUS_MAX_WORKERS];
+};
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Inits the bus object.
+ *
+ * @param bus
+ */
+void fsm_bus_init(struct fsm_bus *bus);
+
+/**
+ * @brief Subscribes an fsm to one event.
+ *
+ * @param bus
+ * @param fsm
+ * @param event
+ * @param worker    Worker (thread/core) that runs the fsm
+ * @return int 0 on success, -1 on error
+ */
+int fsm_bus_subscribe(struct fsm_bus *bus, fsm_t *fsm, int event, unsigned worker);
+
+/**
+ * @brief Subscribes an fsm to every event found in its transitions table.
+ *
+ * @details Events with id >= FSM_MAX_EVENT_ID can't be published and are
+ * skipped. On error the subscriptions added by the call are removed.
+ *
+ * @param bus
+ * @param fsm       Already initialized fsm
+ * @param worker    Worker (thread/core) that runs the fsm
+ * @return int 0 on success, -1 on error
+ */
+int fsm_bus_subscribe_fsm(struct fsm_bus *bus, fsm_t *fsm, unsigned worker);
+
+/**
+ * @brief Removes every subscription of an fsm.
+ *
+ * @param bus
+ * @param fsm
+ */
+void fsm_bus_unsubscribe_fsm(struct fsm_bus *bus, fsm_t *fsm);
+
+/**
+ * @brief Publishes an event. It is queued once per worker with subscribers and
+ * reaches the fsm queues when that worker calls fsm_bus_deliver.
+ *
+ * @details The payload is shared, not copied. release (if not NULL) is called
+ * once every subscriber has processed the event, from the thread that
+ * processed it last. Only one thread may publish at a time.
+ *
+ * @param bus
+ * @param event
+ * @param data
+ * @param release
+ * @return int Number of workers the event was queued to, -1 on error or if a
+ *             worker batch is full
+ */
+int fsm_bus_publish(struct fsm_bus *bus, int event, void *data, void (*release)(void *data));
+
+/**
+ * @brief Dispatches the pending published events to the fsm of one worker.
+ *
+ * @details Only touches the queues of that worker fsm. May run concurrently with
+ * fsm_bus_publish and with the fsm_bus_deliver of other workers, but each
+ * worker must be delivered from a single thread.
+ *
+ * @param bus
+ * @param worker
+ * @return int Number of events delivered
+ */
+int fsm_bus_deliver(struct fsm_bus *bus, unsigned worker);
+
+#endif /* FSM_BUS_H */
@@ -0,0 +1,198 @@
+/**
+ * @file fsm_image.h
+ * @author Mauro Medina
+ * @brief Compiled FSM image: a flat, versioned binary form of the states and
+ *        transitions tables that can be stored in a file (and mmap'd) or
+ *        placed in flash, and loaded at runtime without rebuilding.
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_IMAGE_H
+#define FSM_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fsm.h"
+
+//----------------------------------------------------------------------
+//	DEFINITIONS
+//----------------------------------------------------------------------
+/**
+ * @brief Image magic, "FSMI" read as a native uint32_t. An image built on a
+ * host with a different byte order fails the magic check.
+ *
+ */
+#define FSM_IMAGE_MAGIC     0x494D5346u
+
+/**
+ * @brief Image format version
+ *
+ */
+#define FSM_IMAGE_VERSION   1
+
+/**
+ * @brief Symbol id meaning "no action"
+ *
+ */
+#define FSM_IMAGE_SYM_NONE  0
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+/*
+ * Image layout (every offset is relative to the start of the image, every
+ * reference between records is an index, so the image is position
+ * independent):
+ *
+ *   fsm_image_header
+ *   fsm_image_state      [num_states]       index == state_id, [0] is the null state
+ *   fsm_range_t          [num_states]       lookup index, transitions of each source
+ *   fsm_image_transition [num_transitions]  grouped by source state
+ *
+ * The lookup index is used by the fsm straight from the image memory.
+ */
+struct fsm_image_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t image_size;
+    uint32_t num_states;
+    uint32_t num_transitions;
+    uint32_t num_symbols;           // Symbol table size the image was compiled against
+    uint32_t states_offset;
+    uint32_t index_offset;
+    uint32_t transitions_offset;
+};
+
+struct fsm_image_state {
+    int32_t  state_id;
+    uint16_t parent;                // Parent state index, 0 if none
+    uint16_t default_substate;      // Default substate index, 0 if none
+    uint16_t entry_sym;             // Action symbol ids, FSM_IMAGE_SYM_NONE if none
+    uint16_t run_sym;
+    uint16_t exit_sym;
+    uint16_t depth;                 // Hierarchy depth, 0 for a root state
+};
+
+struct fsm_image_transition {
+    int32_t  event;
+    uint16_t source;
+    uint16_t target;
+};
+
+/**
+ * @brief Action callback as stored in the symbol registration table.
+ *
+ * @details The registration table is an array indexed by symbol id, entry
+ * [FSM_IMAGE_SYM_NONE] must be NULL. The same table (same order) must be used
+ * to build and to bind an image.
+ */
+typedef void (*fsm_image_action_t)(fsm_t *self, void *data);
+
+/**
+ * @brief Loaded image handle
+ *
+ */
+struct fsm_image {
+    const struct fsm_image_header *header;
+    const struct fsm_image_state *states;
+    const fsm_range_t *index;
+    const struct fsm_image_transition *transitions;
+    // Mapping info, only set by fsm_image_map
+    void *map_base;
+    size_t map_size;
+};
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Compiles a states and transitions table into an image.
+ *
+ * @param buf               Output buffer (4 byte aligned), or NULL to query the size
+ * @param size              Output buffer size
+ * @param states            States table (FSM_STATES_GET)
+ * @param num_states        Number of states in the table (FSM_STATES_SIZE)
+ * @param transitions       Transitions table (FSM_TRANSITIONS_GET)
+ * @param num_transitions   Number of transitions (FSM_TRANSITIONS_SIZE)
+ * @param symbols           Symbol registration table, may be NULL if no state has actions
+ * @param num_symbols       Number of entries in the symbol table
+ * @return int              Image size on success, -1 on error
+ */
+int fsm_image_build(void *buf, size_t size,
+                    const fsm_state_t *states, size_t num_states,
+                    const fsm_transition_t *transitions, size_t num_transitions,
+                    const fsm_image_action_t *symbols, size_t num_symbols);
+
+/**
+ * @brief Writes a built image to a file.
+ *
+ * @param path
+ * @param image
+ * @param size
+ * @return int 0 on success, -1 on error
+ */
+int fsm_image_save(const char *path, const void *image, size_t size);
+
+/**
+ * @brief Opens an image already in memory (flash, static buffer, ...).
+ *
+ * @details Only the header and record bounds are checked, records are used in
+ * place.
+ *
+ * @param img
+ * @param buf   Image base address (4 byte aligned)
+ * @param size  Size of the memory holding the image
+ * @return int 0 on success, -1 on error
+ */
+int fsm_image_open(struct fsm_image *img, const void *buf, size_t size);
+
+/**
+ * @brief Maps an image file read-only and opens it.
+ *
+ * @param img
+ * @param path
+ * @return int 0 on success, -1 on error
+ */
+int fsm_image_map(struct fsm_image *img, const char *path);
+
+/**
+ * @brief Unmaps an image opened with fsm_image_map.
+ *
+ * @param img
+ */
+void fsm_image_unmap(struct fsm_image *img);
+
+/**
+ * @brief Binds the image to the actions in the symbol table and inits the fsm.
+ *
+ * @details The core works on fsm_state_t/fsm_transition_t, so the image
+ * records are expanded once into the caller provided tables, which must
+ * outlive the fsm. The lookup index is used in place and the hierarchy is
+ * checked (no cycles, depth as recorded). The image must stay mapped while
+ * the fsm is used.
+ *
+ * @param fsm
+ * @param img
+ * @param symbols           Symbol registration table, may be NULL if no state has actions
+ * @param num_symbols       Number of entries in the symbol table
+ * @param states            States storage, at least header->num_states entries
+ * @param max_states
+ * @param transitions       Transitions storage, at least header->num_transitions entries
+ * @param max_transitions
+ * @param initial_state     Initial state ID
+ * @param initial_data      User custom data struct pointer
+ * @return int 0 on success, -1 on error
+ */
+int fsm_image_init(fsm_t *fsm, const struct fsm_image *img,
+                   const fsm_image_action_t *symbols, size_t num_symbols,
+                   fsm_state_t *states, size_t max_states,
+                   fsm_transition_t *transitions, size_t max_transitions,
+                   int initial_state, void *initial_data);
+
+#endif /* FSM_IMAGE_H */
@@ -0,0 +1,164 @@
+/**
+ * @file fsm_shm.h
+ * @author Mauro Medina
+ * @brief Cross-process events queue in POSIX shared memory (Linux)
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_SHM_H
+#define FSM_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fsm.h"
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+/* Ring slots, power of 2 */
+#ifndef FSM_SHM_CAPACITY
+#define FSM_SHM_CAPACITY 64
+#endif
+
+/* Payload bytes per slot */
+#ifndef FSM_SHM_PAYLOAD_SIZE
+#define FSM_SHM_PAYLOAD_SIZE 64
+#endif
+
+//----------------------------------------------------------------------
+//	DEFINITIONS
+//----------------------------------------------------------------------
+/**
+ * @brief Segment magic, "FSMQ"
+ *
+ */
+#define FSM_SHM_MAGIC 0x514D5346u
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+struct fsm_shm_slot {
+    uint32_t seq;                   // Slot sequence, == position + 1 when ready
+    int32_t event;
+    uint32_t len;
+    uint32_t payload_offset;        // Payload offset from the segment base
+};
+
+/* Shared segment layout, the same in every process */
+struct fsm_shm_segment {
+    uint32_t magic;
+    uint32_t capacity;
+    uint32_t payload_size;
+    uint32_t size;
+    // Producers position, own cache line
+    uint32_t head __attribute__((aligned(64)));
+    // Consumer wakeup: futex word and waiting flag
+    uint32_t futex __attribute__((aligned(64)));
+    uint32_t waiters;
+    struct fsm_shm_slot slots[FSM_SHM_CAPACITY] __attribute__((aligned(64)));
+    uint8_t payloads[FSM_SHM_CAPACITY][FSM_SHM_PAYLOAD_SIZE];
+};
+
+struct fsm_shm;
+
+/* Consumer side reference of a dispatched slot */
+struct fsm_shm_ref {
+    fsm_ref_t ref;
+    struct fsm_shm *shm;
+    uint32_t pos;
+};
+
+/* Process local handle */
+struct fsm_shm {
+    struct fsm_shm_segment *seg;
+    // Consumer position, only used by the owner
+    uint32_t tail;
+    int owner;
+    struct fsm_shm_ref refs[FSM_SHM_CAPACITY];
+};
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Creates the named segment. Called by the process hosting the fsm,
+ * the only consumer of the queue.
+ *
+ * @details Fails if the name already exists. A segment left behind by a
+ * previous host must be removed explicitly with fsm_shm_unlink, once no
+ * producer uses it.
+ *
+ * @param shm
+ * @param name  POSIX shared memory name ("/my_fsm")
+ * @return int 0 on success, -1 on error
+ */
+int fsm_shm_create(struct fsm_shm *shm, const char *name);
+
+/**
+ * @brief Opens an existing named segment. Called by producer processes.
+ *
+ * @param shm
+ * @param name
+ * @return int 0 on success, -1 on error
+ */
+int fsm_shm_open(struct fsm_shm *shm, const char *name);
+
+/**
+ * @brief Unmaps the segment.
+ *
+ * @param shm
+ */
+void fsm_shm_close(struct fsm_shm *shm);
+
+/**
+ * @brief Removes the segment name.
+ *
+ * @param name
+ * @return int 0 on success, -1 on error
+ */
+int fsm_shm_unlink(const char *name);
+
+/**
+ * @brief Dispatches an event into the fsm hosted by another process.
+ *
+ * @details Lock-free, many producers. The payload is copied into the slot;
+ * the consumer is only woken up with a syscall if it is waiting.
+ *
+ * @param shm
+ * @param event
+ * @param data  Payload, may be NULL
+ * @param len   Payload size, up to FSM_SHM_PAYLOAD_SIZE
+ * @return int 0 on success, -1 if the queue is full or len is too big
+ */
+int fsm_remote_dispatch(struct fsm_shm *shm, int event, const void *data, size_t len);
+
+/**
+ * @brief Moves the ready remote events into the fsm queue.
+ *
+ * @details Payloads are not copied: the actions receive a pointer into the
+ * segment, and the slot is given back to the producers once the event is
+ * processed. Stops when the fsm queue is full. An event whose slot holds an
+ * invalid length or offset is dispatched with NULL data.
+ *
+ * @param shm
+ * @param fsm
+ * @return int Number of events moved
+ */
+int fsm_shm_poll(struct fsm_shm *shm, fsm_t *fsm);
+
+/**
+ * @brief Sleeps until a remote event is ready.
+ *
+ * @param shm
+ * @param timeout_ms    Negative waits forever
+ * @return int 1 if events are ready, 0 on timeout
+ */
+int fsm_shm_wait(struct fsm_shm *shm, int timeout_ms);
+
+#endif /* FSM_SHM_H */
@@ -12,6 +12,8 @@
 #ifndef RING_BUFF_H_
 #define RING_BUFF_H_
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
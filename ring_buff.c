@@ -8,6 +8,7 @@
  * @copyright Copyright (c) 2024
  * 
  */
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -91,7 +92,7 @@ uint32_t ringbuff_num(const struct ringbuff *const rb)
 
 	if(len < 0)
 	{
-		len = rb->len - len;
+		len = rb->len + len;
 	}
 
 	return len;